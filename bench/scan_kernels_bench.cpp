@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmarks of the scan projection on synthetic clouds.
+ * Needs no ROS master, run bin/scan_kernels_bench. Reports points/s and
+ * time/point for every cloud, kernel and thread count, and for the depth
+ * camera clouds binned as depth images through their pixel table.
+ */
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "scan_projection.h"
+
+using namespace pointcloud_to_laserscan;
+
+namespace
+{
+
+const float NaN = std::numeric_limits<float>::quiet_NaN();
+
+/** An organized cloud of x/y/z floats at the start of each point. */
+struct SyntheticCloud
+{
+  std::vector<uint8_t> data;
+  size_t point_step;
+  uint32_t width, height;
+  bool dense; // no nan points
+  double transform[12]; // into the output frame
+  float min_height, max_height;
+  bool depth_camera; // point (u, v) lies on the ray of pixel (u, v) of camera
+  CameraIntrinsics camera;
+
+  float* point(uint32_t row, uint32_t col)
+  {
+    return reinterpret_cast<float*>(&data[((size_t)row * width + col) * point_step]);
+  }
+};
+
+void setTransform(SyntheticCloud& cloud, const double* transform, float min_height, float max_height)
+{
+  std::copy(transform, transform + 12, cloud.transform);
+  cloud.min_height = min_height;
+  cloud.max_height = max_height;
+}
+
+/**
+ * Depth camera cloud in the optical frame, 0.5 m above the floor and facing
+ * a wall at 4 m. Every nan_every-th pixel has no return, 1 makes every
+ * pixel nan and 0 none. A dense slab lets every point pass the filter.
+ */
+SyntheticCloud makeDepthCloud(uint32_t width, uint32_t height, int nan_every, bool dense_slab)
+{
+  SyntheticCloud cloud;
+  cloud.point_step = 16; // pcl::PointXYZ
+  cloud.depth_camera = true;
+  cloud.width = width;
+  cloud.height = height;
+  cloud.dense = nan_every == 0;
+  cloud.data.resize((size_t)width * height * cloud.point_step);
+
+  const float f = 525.0f * width / 640.0f, cx = width / 2.0f, cy = height / 2.0f;
+  cloud.camera.fx = cloud.camera.fy = f;
+  cloud.camera.cx = cx;
+  cloud.camera.cy = cy;
+  for (uint32_t v = 0; v < height; ++v)
+  {
+    for (uint32_t u = 0; u < width; ++u)
+    {
+      float dx = (u - cx) / f, dy = (v - cy) / f;
+      float depth = 4.0f;
+      if (!dense_slab && dy > 0.0f)
+        depth = std::min(depth, 0.5f / dy);
+      float* p = cloud.point(v, u);
+      bool nan = nan_every > 0 && (v * width + u) % nan_every == 0;
+      p[0] = nan ? NaN : depth * dx;
+      p[1] = nan ? NaN : depth * dy;
+      p[2] = nan ? NaN : depth;
+    }
+  }
+
+  // optical frame into the output frame: x forward, y left, z up
+  const double transform[12] = { 0, 0, 1, 0,
+                                -1, 0, 0, 0,
+                                 0,-1, 0, 0.5 };
+  if (dense_slab)
+    setTransform(cloud, transform, -10.0f, 10.0f);
+  else
+    setTransform(cloud, transform, 0.10f, 0.15f);
+  return cloud;
+}
+
+/**
+ * One sweep of a spinning lidar 1.8 m above the floor, rings evenly spread
+ * from -25 to 15 degrees, inside a round room of 15 m radius.
+ */
+SyntheticCloud makeLidarCloud(uint32_t rings, uint32_t columns)
+{
+  SyntheticCloud cloud;
+  cloud.point_step = 32; // x, y, z, intensity, ring and padding
+  cloud.depth_camera = false;
+  cloud.width = columns;
+  cloud.height = rings;
+  cloud.dense = true;
+  cloud.data.resize((size_t)rings * columns * cloud.point_step);
+
+  for (uint32_t ring = 0; ring < rings; ++ring)
+  {
+    double elevation = (-25.0 + 40.0 * ring / (rings - 1)) * M_PI / 180.0;
+    for (uint32_t col = 0; col < columns; ++col)
+    {
+      double azimuth = 2.0 * M_PI * col / columns - M_PI;
+      double range = 15.0 / cos(elevation);
+      if (elevation < 0.0)
+        range = std::min(range, 1.8 / -sin(elevation));
+      float* p = cloud.point(ring, col);
+      p[0] = range * cos(elevation) * cos(azimuth);
+      p[1] = range * cos(elevation) * sin(azimuth);
+      p[2] = range * sin(elevation);
+    }
+  }
+
+  const double transform[12] = { 1, 0, 0, 0,
+                                 0, 1, 0, 0,
+                                 0, 0, 1, 1.8 };
+  setTransform(cloud, transform, 0.10f, 1.5f);
+  return cloud;
+}
+
+void benchmarkCloud(benchmark::State& state, const SyntheticCloud* cloud, FilterKernel kernel, size_t num_threads)
+{
+  ProjectionConfig config;
+  config.min_height = cloud->min_height;
+  config.max_height = cloud->max_height;
+  config.angle_min = -M_PI;
+  config.angle_max = M_PI;
+  config.angle_increment = M_PI / 360.0;
+  config.num_threads = num_threads;
+  config.update();
+
+  CloudView view;
+  view.data = &cloud->data[0];
+  view.point_step = cloud->point_step;
+  view.row_step = cloud->width * cloud->point_step;
+  view.width = cloud->width;
+  view.height = cloud->height;
+  view.dense = cloud->dense;
+  const size_t num_points = (size_t)cloud->width * cloud->height;
+
+  ScanProjector projector;
+  projector.setKernel(kernel);
+  std::vector<float> ranges(config.ranges_size);
+  float* scan_ranges = &ranges[0];
+  PointCounts counts;
+  for (auto _ : state)
+  {
+    std::fill(ranges.begin(), ranges.end(), std::numeric_limits<float>::infinity());
+    projector.project(view, cloud->transform, config, &scan_ranges, counts);
+    benchmark::DoNotOptimize(ranges.data());
+  }
+
+  state.counters["points/s"] = benchmark::Counter(num_points, benchmark::Counter::kIsIterationInvariantRate);
+  // inverted rate in seconds, printed with an SI prefix such as 3.1ns
+  state.counters["time/point"] = benchmark::Counter(num_points, benchmark::Counter::kIsIterationInvariantRate |
+                                                                benchmark::Counter::kInvert);
+  state.counters["accepted"] = (double)counts.accepted / state.iterations();
+}
+
+/** The depth image of a depth camera cloud, binned through its pixel table. */
+void benchmarkDepthTable(benchmark::State& state, const SyntheticCloud* cloud)
+{
+  ProjectionConfig config;
+  config.min_height = cloud->min_height;
+  config.max_height = cloud->max_height;
+  config.angle_min = -M_PI;
+  config.angle_max = M_PI;
+  config.angle_increment = M_PI / 360.0;
+  config.update();
+
+  const CameraIntrinsics& camera = cloud->camera;
+  const size_t num_points = (size_t)cloud->width * cloud->height;
+  std::vector<float> depths(num_points);
+  std::vector<PixelBin> bins(num_points);
+  for (uint32_t v = 0; v < cloud->height; ++v)
+  {
+    for (uint32_t u = 0; u < cloud->width; ++u)
+    {
+      // the optical z of a point is its depth
+      const size_t pixel = (size_t)v * cloud->width + u;
+      depths[pixel] = reinterpret_cast<const float*>(&cloud->data[pixel * cloud->point_step])[2];
+      setPixelRay(bins[pixel], config, cloud->transform, (u - camera.cx) / camera.fx,
+                  (v - camera.cy) / camera.fy, 1.0);
+    }
+  }
+
+  std::vector<float> ranges(config.ranges_size);
+  float* scan_ranges = &ranges[0];
+  PointCounts counts;
+  for (auto _ : state)
+  {
+    std::fill(ranges.begin(), ranges.end(), std::numeric_limits<float>::infinity());
+    binDepthImage<float>(config, reinterpret_cast<const uint8_t*>(&depths[0]), cloud->width * sizeof(float),
+                         cloud->width, PixelRegion(cloud->width, cloud->height), &bins[0], cloud->transform[11],
+                         &scan_ranges, counts);
+    benchmark::DoNotOptimize(ranges.data());
+  }
+
+  state.counters["points/s"] = benchmark::Counter(num_points, benchmark::Counter::kIsIterationInvariantRate);
+  state.counters["time/point"] = benchmark::Counter(num_points, benchmark::Counter::kIsIterationInvariantRate |
+                                                                benchmark::Counter::kInvert);
+  state.counters["accepted"] = (double)counts.accepted / state.iterations();
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  static const struct
+  {
+    const char* name;
+    SyntheticCloud cloud;
+  } clouds[] = {
+    { "kinect_vga", makeDepthCloud(640, 480, 20, false) },
+    { "kinect_qvga", makeDepthCloud(320, 240, 20, false) },
+    { "kinect_vga_all_nan", makeDepthCloud(640, 480, 1, false) },
+    { "kinect_vga_dense", makeDepthCloud(640, 480, 0, true) },
+    { "lidar_64", makeLidarCloud(64, 2048) },
+    { "lidar_128", makeLidarCloud(128, 2048) },
+  };
+  const char* kernels[] = { "scalar", "sse", "avx2" };
+  const size_t threads[] = { 1, 2, 4 };
+
+  for (size_t c = 0; c < sizeof(clouds) / sizeof(clouds[0]); ++c)
+  {
+    if (clouds[c].cloud.depth_camera)
+    {
+      std::string name = std::string(clouds[c].name) + "/depth_table";
+      benchmark::RegisterBenchmark(name.c_str(), benchmarkDepthTable, &clouds[c].cloud)->UseRealTime();
+    }
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+    {
+      std::string selected;
+      FilterKernel kernel = selectFilterKernel(kernels[k], &selected);
+      if (selected != kernels[k])
+        continue; // not supported by this build or CPU
+      for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t)
+      {
+        std::string name = std::string(clouds[c].name) + "/" + kernels[k] + "/threads:" + std::to_string(threads[t]);
+        benchmark::RegisterBenchmark(name.c_str(), benchmarkCloud, &clouds[c].cloud, kernel, threads[t])->UseRealTime();
+      }
+    }
+  }
+
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
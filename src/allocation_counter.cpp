@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "allocation_counter.h"
+
+#ifdef CLOUD_TO_SCAN_COUNT_ALLOCATIONS
+
+#include <stdlib.h>
+#include <new>
+
+namespace
+{
+__thread bool tracking = false;
+uint64_t allocations = 0;
+
+inline void* allocate(size_t size)
+{
+  if (tracking)
+    __sync_fetch_and_add(&allocations, 1);
+  return malloc(size ? size : 1);
+}
+}
+
+namespace pointcloud_to_laserscan
+{
+
+uint64_t trackedAllocations()
+{
+  return __sync_fetch_and_add(&allocations, 0);
+}
+
+ScopedAllocationTracking::ScopedAllocationTracking(): previous_(tracking)
+{
+  tracking = true;
+}
+
+ScopedAllocationTracking::~ScopedAllocationTracking()
+{
+  tracking = previous_;
+}
+
+} // namespace pointcloud_to_laserscan
+
+// Dynamic exception specifications are deprecated in C++11 and gone in C++17.
+#if __cplusplus >= 201103L
+#define THROWS_BAD_ALLOC
+#define THROWS_NOTHING noexcept
+#else
+#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define THROWS_NOTHING throw()
+#endif
+
+void* operator new(size_t size) THROWS_BAD_ALLOC
+{
+  void* ptr = allocate(size);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](size_t size) THROWS_BAD_ALLOC
+{
+  void* ptr = allocate(size);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) THROWS_NOTHING
+{
+  return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) THROWS_NOTHING
+{
+  return allocate(size);
+}
+
+void operator delete(void* ptr) THROWS_NOTHING
+{
+  free(ptr);
+}
+
+void operator delete[](void* ptr) THROWS_NOTHING
+{
+  free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) THROWS_NOTHING
+{
+  free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) THROWS_NOTHING
+{
+  free(ptr);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* ptr, size_t) THROWS_NOTHING
+{
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) THROWS_NOTHING
+{
+  free(ptr);
+}
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef POINTCLOUD_TO_LASERSCAN_ALLOCATION_COUNTER_H
+#define POINTCLOUD_TO_LASERSCAN_ALLOCATION_COUNTER_H
+
+#include <stdint.h>
+
+namespace pointcloud_to_laserscan
+{
+
+/*
+ * Heap allocation counting for test builds with CLOUD_TO_SCAN_COUNT_ALLOCATIONS
+ * defined. Global operator new is replaced and counts the allocations made by
+ * threads while they hold a ScopedAllocationTracking. In regular builds this
+ * compiles to nothing.
+ */
+#ifdef CLOUD_TO_SCAN_COUNT_ALLOCATIONS
+
+/** Returns the number of allocations made by tracked threads so far. */
+uint64_t trackedAllocations();
+
+/** Counts allocations of the current thread while in scope. */
+class ScopedAllocationTracking
+{
+public:
+  ScopedAllocationTracking();
+  ~ScopedAllocationTracking();
+
+private:
+  bool previous_;
+};
+
+#else
+
+inline uint64_t trackedAllocations() { return 0; }
+
+class ScopedAllocationTracking
+{
+public:
+  ScopedAllocationTracking() {}
+};
+
+#endif
+
+} // namespace pointcloud_to_laserscan
+
+#endif
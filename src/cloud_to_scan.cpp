@@ -31,42 +31,133 @@
 #include "pluginlib/class_list_macros.h"
 #include "nodelet/nodelet.h"
 #include "sensor_msgs/LaserScan.h"
+#include "sensor_msgs/PointCloud2.h"
+#include "sensor_msgs/Image.h"
+#include "sensor_msgs/CameraInfo.h"
+#include "sensor_msgs/image_encodings.h"
 #include "pcl/point_cloud.h"
 #include "pcl_ros/point_cloud.h"
 #include "pcl/point_types.h"
 #include "pcl/ros/conversions.h"
 #include "dynamic_reconfigure/server.h"
 #include "pointcloud_to_laserscan/CloudScanConfig.h"
+#include "scan_projection.h"
+#include "allocation_counter.h"
+#include "latency_histogram.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
 #include <tf/transform_listener.h>
 #include <tf/transform_broadcaster.h>
+#include <tf/message_filter.h>
+#include <message_filters/subscriber.h>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/signals.hpp>
+#include <limits>
 #include <math.h>
+#include <string.h>
+
+// Per-stage latency histograms cost a few clock reads per cloud. Build with
+// CLOUD_TO_SCAN_NO_LATENCY_STATS to remove them completely.
+#ifdef CLOUD_TO_SCAN_NO_LATENCY_STATS
+#define LATENCY_STATS_BUILT false
+#else
+#define LATENCY_STATS_BUILT true
+#endif
 
 namespace pointcloud_to_laserscan
 {
+/**
+ * Scan configuration and the values derived from it. A published instance is
+ * never modified, reconfigure() swaps in a new one.
+ */
+struct ScanConfig : ProjectionConfig
+{
+  ScanConfig(): scan_time(1.0/30.0),
+                range_max(10.0),
+                generation(0)
+  {
+  }
+
+  double scan_time, range_max;
+  uint32_t generation; // changes with every reconfigure, invalidates caches built for older configurations
+};
+
+typedef boost::shared_ptr<const ScanConfig> ScanConfigConstPtr;
+
 class CloudToScan : public nodelet::Nodelet
 {
 public:
   //Constructor
-  CloudToScan(): min_height_(0.10),
-                 max_height_(0.15),
-                 angle_min_(-M_PI/2),
-                 angle_max_(M_PI/2),
-                 angle_increment_(M_PI/180.0/2.0),
-                 scan_time_(1.0/30.0),
-                 range_min_(0.45),
-                 range_max_(10.0),
+  CloudToScan(): config_(new ScanConfig()),
                  output_frame_id_("/kinect_depth_frame"),
-                 ref_frame_id_("/kinect_link")
+                 ref_frame_id_("/kinect_link"),
+                 raw_cloud_(false),
+                 depth_image_(false),
+                 roi_x_offset_(0),
+                 roi_y_offset_(0),
+                 roi_width_(0),
+                 roi_height_(0),
+                 row_stride_(1),
+                 col_stride_(1),
+                 auto_row_band_(false),
+                 column_azimuth_(false),
+                 column_azimuth_start_(0.0),
+                 column_azimuth_increment_(0.0),
+                 time_budget_(0.0),
+                 anytime_passes_(8),
+                 max_load_stride_(1),
+                 target_load_(0.8),
+                 load_stride_(1),
+                 frames_at_stride_(0),
+                 binning_threads_(1),
+                 frame_time_(0.0),
+                 input_period_(0.0),
+                 use_pixel_table_(false),
+                 pixel_table_generation_(0),
+                 pixel_table_camera_(),
+                 kernel_name_("auto"),
+                 tf_queue_size_(10),
+                 transform_tolerance_(0.0),
+                 static_transform_(false),
+                 static_transform_period_(1.0),
+                 frame_period_(0.0),
+                 frame_threshold_(0.0),
+                 stats_rate_(1.0),
+                 tf_dropped_(0),
+                 tf_expired_(0),
+                 arrivals_(),
+                 arrival_next_(0),
+                 latest_only_(false),
+                 mailbox_shutdown_(false),
+                 mailbox_dropped_(0),
+                 fusion_pending_(0),
+                 fusion_config_(NULL),
+                 max_frame_lag_(0.1),
+                 publishing_(false),
+                 pipeline_dropped_(0),
+                 allocation_check_generation_(0),
+                 allocation_check_frames_(0)
   {
   };
 
   ~CloudToScan()
   {
+    frame_pool_.reset(); // finishes the frames being binned
+    if (mailbox_thread_)
+    {
+      {
+        boost::lock_guard<boost::mutex> lock(mailbox_mutex_);
+        mailbox_shutdown_ = true;
+      }
+      mailbox_cond_.notify_one();
+      mailbox_thread_->join();
+    }
     delete srv_;
   }
 
 private:
   typedef pcl::PointCloud<pcl::PointXYZ> PointCloud;
+  struct Frame;
 
   boost::mutex connect_mutex_;
   // Dynamic reconfigure server
@@ -80,171 +171,2094 @@ private:
     nh_ = getNodeHandle();
     ros::NodeHandle& private_nh = getPrivateNodeHandle();
 
-    private_nh.getParam("min_height", min_height_);
-    private_nh.getParam("max_height", max_height_);
-
-    private_nh.getParam("angle_min", angle_min_);
-    private_nh.getParam("angle_max", angle_max_);
-    private_nh.getParam("angle_increment", angle_increment_);
-    private_nh.getParam("scan_time", scan_time_);
-    private_nh.getParam("range_min", range_min_);
-    private_nh.getParam("range_max", range_max_);
+    boost::shared_ptr<ScanConfig> config(new ScanConfig());
+    private_nh.getParam("min_height", config->min_height);
+    private_nh.getParam("max_height", config->max_height);
 
-    range_min_sq_ = range_min_ * range_min_;
+    private_nh.getParam("angle_min", config->angle_min);
+    private_nh.getParam("angle_max", config->angle_max);
+    private_nh.getParam("angle_increment", config->angle_increment);
+    private_nh.getParam("scan_time", config->scan_time);
+    private_nh.getParam("range_min", config->range_min);
+    private_nh.getParam("range_max", config->range_max);
+    private_nh.getParam("num_threads", config->num_threads);
 
     private_nh.getParam("output_frame_id", output_frame_id_);
     private_nh.getParam("ref_frame_id", ref_frame_id_);
 
+    // Several height bands can be cut out of the same cloud in one pass, each
+    // published as its own scan. ~bands is a list of
+    // {min_height, max_height, topic, frame_id}. Without it there is a single
+    // scan on "scan" between min_height and max_height.
+    loadBands(private_nh);
+    config->bands = bands_;
+    config->update();
+    boost::atomic_store(&config_, ScanConfigConstPtr(config));
+
+
+    // Subscribe to sensor_msgs/PointCloud2 and read x/y/z in place instead of
+    // converting every message to a pcl::PointCloud first.
+    private_nh.getParam("raw_cloud", raw_cloud_);
+
+    // Bin organized clouds through a per-pixel lookup table. Only valid for
+    // clouds where every pixel lies on a fixed ray from the sensor origin,
+    // e.g. clouds generated from a depth image.
+    private_nh.getParam("pixel_table", use_pixel_table_);
+
+    // Subscribe to a depth image and its camera info instead of a cloud and
+    // project the pixels through rays computed from the camera matrix. The
+    // image has to be rectified, 16UC1 in millimeters or 32FC1 in meters.
+    private_nh.getParam("depth_image", depth_image_);
+
+    // Region of interest of organized clouds and depth images, in pixels, as
+    // in sensor_msgs/RegionOfInterest. A width or height of 0 extends it to
+    // the image border. Only every row_stride-th row and col_stride-th column
+    // in it is processed.
+    private_nh.getParam("roi_x_offset", roi_x_offset_);
+    private_nh.getParam("roi_y_offset", roi_y_offset_);
+    private_nh.getParam("roi_width", roi_width_);
+    private_nh.getParam("roi_height", roi_height_);
+    private_nh.getParam("row_stride", row_stride_);
+    private_nh.getParam("col_stride", col_stride_);
+    roi_x_offset_ = std::max(roi_x_offset_, 0);
+    roi_y_offset_ = std::max(roi_y_offset_, 0);
+    row_stride_ = std::max(row_stride_, 1);
+    col_stride_ = std::max(col_stride_, 1);
+
+    // Skip the image rows whose rays can not reach the height slab within
+    // range_max. Needs the camera info, which clouds are then subscribed to as
+    // well.
+    private_nh.getParam("auto_row_band", auto_row_band_);
+
+    // Lidar clouds: elevation of each ring in degrees, as seen from the cloud
+    // frame origin. Row i of organized clouds is ring i, and their rows whose
+    // ring can not reach the height slab within range_max are skipped.
+    // Unorganized clouds need raw_cloud and a ring field; points of rings
+    // that can not reach the slab, or at distances where their ring is
+    // outside it, are dropped before they are transformed.
+    loadRingElevations(private_nh);
+
+    // Bin organized lidar clouds through a per-pixel table like pixel_table,
+    // built from the ring elevations and a column azimuth of
+    // column_azimuth_start + col * column_azimuth_increment degrees instead
+    // of from the points. An increment of 0 spreads the columns over one
+    // clockwise revolution.
+    private_nh.getParam("column_azimuth", column_azimuth_);
+    private_nh.getParam("column_azimuth_start", column_azimuth_start_);
+    private_nh.getParam("column_azimuth_increment", column_azimuth_increment_);
+    column_azimuth_start_ *= M_PI / 180.0;
+    column_azimuth_increment_ *= M_PI / 180.0;
+    if (column_azimuth_ && ring_elevations_.empty())
+    {
+      NODELET_WARN("column_azimuth needs ring_elevations, ignoring it.");
+      column_azimuth_ = false;
+    }
+
+    // Anytime mode: process each frame in anytime_passes interleaved passes
+    // (rounded up to a power of two) and publish what was binned once
+    // binning took time_budget seconds. The first pass is a coarse subset
+    // covering all bins and always completes. 0 processes every point.
+    private_nh.getParam("time_budget", time_budget_);
+    int passes = anytime_passes_;
+    private_nh.getParam("anytime_passes", passes);
+    for (anytime_passes_ = 1; (int)anytime_passes_ < passes; anytime_passes_ <<= 1)
+      ;
+
+    // Overload control: when a frame, from the transform lookup until its
+    // scans are published, takes more than target_load of the input period
+    // (times pipeline_threads, which bin frames side by side), the column
+    // stride is doubled, up to max_load_stride, and lowered again once the
+    // load drops. 1 disables it.
+    private_nh.getParam("max_load_stride", max_load_stride_);
+    private_nh.getParam("target_load", target_load_);
+
+    // Point filter kernel: "auto" picks the fastest one the CPU supports,
+    // "scalar", "sse" or "avx2" force a specific one.
+    private_nh.getParam("kernel", kernel_name_);
+    std::string selected_kernel;
+    kernel_ = selectFilterKernel(kernel_name_, &selected_kernel);
+    frame_.projector.setKernel(kernel_);
+    NODELET_INFO("Using %s point filter kernel.", selected_kernel.c_str());
+
+
+    // Scans are recycled once all subscribers released them, so steady state
+    // processing does not allocate.
+    int scan_pool_size = 4;
+    private_nh.getParam("scan_pool_size", scan_pool_size);
+    for (size_t i = 0; i < scan_pool_size * outputs_.size(); ++i)
+      scan_pool_.push_back(sensor_msgs::LaserScanPtr(new sensor_msgs::LaserScan()));
+
+    // Clouds wait in a tf message filter until their transform into the
+    // reference frame is available. When the queue is full the oldest cloud
+    // is dropped.
+    private_nh.getParam("tf_queue_size", tf_queue_size_);
+
+    // If the transform of the cloud frame moved by less than
+    // transform_tolerance (meters and radians) since the last cloud, the
+    // cached transform and everything derived from it are kept; 0 requires an
+    // exact match, a negative value rederives the transform for every cloud.
+    // With static_transform the transform is only looked up again every
+    // static_transform_period seconds, at the latest time tf has, and clouds
+    // do not wait in the tf message filter. Only for sensors that do not move
+    // relative to the reference frame: the cached transform is reused for
+    // every stamp.
+    private_nh.getParam("transform_tolerance", transform_tolerance_);
+    private_nh.getParam("static_transform", static_transform_);
+    private_nh.getParam("static_transform_period", static_transform_period_);
+
+    // The virtual laser frames are broadcast with every cloud by default. With
+    // frame_broadcast_period > 0 a timer broadcasts them at that period
+    // instead, and the clouds only update them when they moved by more than
+    // frame_broadcast_threshold (meters and radians).
+    private_nh.getParam("frame_broadcast_period", frame_period_);
+    private_nh.getParam("frame_broadcast_threshold", frame_threshold_);
+    if (frame_period_ > 0.0)
+      frame_timer_ = nh_.createTimer(ros::Duration(frame_period_), &CloudToScan::broadcastFrames, this);
+
+    // Rejection counters and drops are published on ~statistics as a
+    // diagnostic_msgs/DiagnosticArray, at stats_rate Hz. 0 disables them.
+    private_nh.getParam("stats_rate", stats_rate_);
+    if (stats_rate_ > 0.0)
+    {
+      stats_pub_ = private_nh.advertise<diagnostic_msgs::DiagnosticArray>("statistics", 1);
+      stats_timer_ = nh_.createTimer(ros::Duration(1.0 / stats_rate_), &CloudToScan::publishStatistics, this);
+    }
+
+    // Fuse the clouds of several sensors into one scan: ~clouds lists their
+    // topics. Each sensor is projected on its own worker straight into
+    // output_frame_id, which has to be a frame in tf, and the results are
+    // min-reduced. Clouds whose stamps lie within sync_window seconds of the
+    // first one are published together.
+    private_nh.getParam("latest_only", latest_only_);
+    loadFusionInputs(private_nh);
+    if (!fusion_inputs_.empty())
+    {
+      double sync_window = 0.05;
+      private_nh.getParam("sync_window", sync_window);
+      fusion_window_ = ros::Duration(sync_window);
+      fusion_pool_.reset(new WorkerPool(fusion_inputs_.size() - 1));
+      for (size_t i = 0; i < fusion_inputs_.size(); ++i)
+        fusion_inputs_[i]->projector.setKernel(kernel_);
+      project_input_ = boost::bind(&CloudToScan::projectFusionInput, this, _1);
+      if (raw_cloud_ || depth_image_ || use_pixel_table_ || !ring_elevations_.empty() || latest_only_)
+        NODELET_WARN("Fusing %u clouds, raw_cloud, depth_image, pixel_table, ring_elevations and latest_only are ignored.",
+                     (unsigned)fusion_inputs_.size());
+      latest_only_ = false;
+    }
+
+    // Process several frames at once: pipeline_threads threads bin up to
+    // pipeline_depth frames concurrently and their scans are published in
+    // stamp order. Frames arriving while all of them are in flight are
+    // dropped, as is a frame still binning while one stamped more than
+    // max_frame_lag seconds later is done. Pixel tables, depth images and
+    // fusion share state between frames and always process one at a time.
+    int pipeline_threads = 0;
+    private_nh.getParam("pipeline_threads", pipeline_threads);
+    if (pipeline_threads > 0 && (depth_image_ || use_pixel_table_ || column_azimuth_ || !fusion_inputs_.empty()))
+    {
+      NODELET_WARN("pipeline_threads is not supported with depth_image, pixel_table, column_azimuth or clouds, ignoring it.");
+      pipeline_threads = 0;
+    }
+    if (pipeline_threads > 0)
+    {
+      int pipeline_depth = 2 * pipeline_threads;
+      private_nh.getParam("pipeline_depth", pipeline_depth);
+      private_nh.getParam("max_frame_lag", max_frame_lag_);
+      pipeline_depth = std::max(pipeline_depth, pipeline_threads);
+      for (int i = 0; i < pipeline_depth; ++i)
+      {
+        pipeline_frames_.push_back(boost::shared_ptr<Frame>(new Frame()));
+        pipeline_frames_.back()->projector.setKernel(kernel_);
+        free_frames_.push_back(pipeline_frames_.back().get());
+      }
+      // frames in flight hold scans as well
+      for (size_t i = 0; i < pipeline_depth * outputs_.size(); ++i)
+        scan_pool_.push_back(sensor_msgs::LaserScanPtr(new sensor_msgs::LaserScan()));
+      frame_pool_.reset(new WorkerPool(pipeline_threads));
+      // large clouds are split across the same threads instead of a pool per frame
+      for (size_t i = 0; i < pipeline_frames_.size(); ++i)
+        pipeline_frames_[i]->projector.setPool(frame_pool_.get());
+      binning_threads_ = pipeline_threads;
+      if (latest_only_)
+        NODELET_WARN("latest_only is ignored with pipeline_threads.");
+      latest_only_ = false;
+    }
+
+    // Process clouds on a dedicated thread that only ever sees the newest
+    // cloud. A cloud arriving while the previous one is still waiting
+    // replaces it, so scans are at most one frame behind.
+    if (latest_only_)
+      mailbox_thread_.reset(new boost::thread(boost::bind(&CloudToScan::mailboxLoop, this)));
+
+    // The arrival of each cloud is recorded for the latency statistics. These
+    // callbacks have to be registered before the message filters, so they
+    // run before a cloud that needs no waiting is processed.
+    if (!fusion_inputs_.empty())
+    {
+      for (size_t i = 0; i < fusion_inputs_.size(); ++i)
+      {
+        FusionInput& input = *fusion_inputs_[i];
+        input.sub.registerCallback(&CloudToScan::recordArrival<sensor_msgs::PointCloud2>, this);
+        connectInput(input.sub, input.filter, output_frame_id_, boost::bind(&CloudToScan::fusionCallback, this, _1, i));
+      }
+    }
+    else if (depth_image_)
+    {
+      image_sub_.registerCallback(&CloudToScan::recordArrival<sensor_msgs::Image>, this);
+      if (latest_only_)
+        connectInput(image_sub_, image_filter_, ref_frame_id_, boost::bind(&CloudToScan::postImage, this, _1));
+      else
+        connectInput(image_sub_, image_filter_, ref_frame_id_, boost::bind(&CloudToScan::depthCallback, this, _1));
+    }
+    else if (raw_cloud_)
+    {
+      raw_sub_.registerCallback(&CloudToScan::recordArrival<sensor_msgs::PointCloud2>, this);
+      if (frame_pool_)
+        connectInput(raw_sub_, raw_filter_, ref_frame_id_,
+                     boost::bind(&CloudToScan::dispatchFrame<sensor_msgs::PointCloud2>, this, _1));
+      else if (latest_only_)
+        connectInput(raw_sub_, raw_filter_, ref_frame_id_, boost::bind(&CloudToScan::postRawCloud, this, _1));
+      else
+        connectInput(raw_sub_, raw_filter_, ref_frame_id_, boost::bind(&CloudToScan::rawCallback, this, _1));
+    }
+    else
+    {
+      cloud_sub_.registerCallback(&CloudToScan::recordArrival<PointCloud>, this);
+      if (frame_pool_)
+        connectInput(cloud_sub_, cloud_filter_, ref_frame_id_, boost::bind(&CloudToScan::dispatchFrame<PointCloud>, this, _1));
+      else if (latest_only_)
+        connectInput(cloud_sub_, cloud_filter_, ref_frame_id_, boost::bind(&CloudToScan::postCloud, this, _1));
+      else
+        connectInput(cloud_sub_, cloud_filter_, ref_frame_id_, boost::bind(&CloudToScan::callback, this, _1));
+    }
+
     srv_ = new dynamic_reconfigure::Server<pointcloud_to_laserscan::CloudScanConfig>(private_nh);
     dynamic_reconfigure::Server<pointcloud_to_laserscan::CloudScanConfig>::CallbackType f = boost::bind(&CloudToScan::reconfigure, this, _1, _2);
     srv_->setCallback(f);
 
     // Lazy subscription to point cloud topic
-    ros::AdvertiseOptions scan_ao = ros::AdvertiseOptions::create<sensor_msgs::LaserScan>(
-      "scan", 10,
-      boost::bind( &CloudToScan::connectCB, this),
-      boost::bind( &CloudToScan::disconnectCB, this), ros::VoidPtr(), nh_.getCallbackQueue());
-
     boost::lock_guard<boost::mutex> lock(connect_mutex_);
-    pub_ = nh_.advertise(scan_ao);
+    for (size_t i = 0; i < outputs_.size(); ++i)
+    {
+      ros::AdvertiseOptions scan_ao = ros::AdvertiseOptions::create<sensor_msgs::LaserScan>(
+        outputs_[i].topic, 10,
+        boost::bind( &CloudToScan::connectCB, this),
+        boost::bind( &CloudToScan::disconnectCB, this), ros::VoidPtr(), nh_.getCallbackQueue());
+      outputs_[i].pub = nh_.advertise(scan_ao);
+    }
   };
 
+  /**
+   * Reads the ~bands parameter into bands_ and sets up one output per band,
+   * or the single "scan" output when there are none.
+   */
+  void loadBands(ros::NodeHandle& private_nh)
+  {
+    XmlRpc::XmlRpcValue bands;
+    if (private_nh.getParam("bands", bands))
+    {
+      if (bands.getType() != XmlRpc::XmlRpcValue::TypeArray)
+      {
+        NODELET_ERROR("~bands has to be a list, ignoring it.");
+      }
+      else
+      {
+        for (int i = 0; i < bands.size(); ++i)
+        {
+          XmlRpc::XmlRpcValue& band = bands[i];
+          if (band.getType() != XmlRpc::XmlRpcValue::TypeStruct ||
+              !band.hasMember("min_height") || !band.hasMember("max_height") ||
+              !band.hasMember("topic") || !band.hasMember("frame_id") ||
+              band["topic"].getType() != XmlRpc::XmlRpcValue::TypeString ||
+              band["frame_id"].getType() != XmlRpc::XmlRpcValue::TypeString)
+          {
+            NODELET_ERROR("~bands[%d] needs min_height, max_height, topic and frame_id, ignoring it.", i);
+            continue;
+          }
+
+          double min_height, max_height;
+          if (!xmlRpcNumber(band["min_height"], min_height) || !xmlRpcNumber(band["max_height"], max_height))
+          {
+            NODELET_ERROR("~bands[%d] heights have to be numbers, ignoring it.", i);
+            continue;
+          }
+
+          bands_.push_back(HeightBand(min_height, max_height));
+          outputs_.push_back(ScanOutput(band["topic"], band["frame_id"]));
+        }
+      }
+    }
+
+    if (outputs_.empty())
+      outputs_.push_back(ScanOutput("scan", output_frame_id_));
+    else
+      NODELET_INFO("Publishing %u height bands, min_height and max_height are ignored.", (unsigned)outputs_.size());
+  }
+
+  /** Reads the ~clouds parameter into fusion_inputs_. */
+  void loadFusionInputs(ros::NodeHandle& private_nh)
+  {
+    XmlRpc::XmlRpcValue clouds;
+    if (!private_nh.getParam("clouds", clouds))
+      return;
+    if (clouds.getType() != XmlRpc::XmlRpcValue::TypeArray)
+    {
+      NODELET_ERROR("~clouds has to be a list of topics, ignoring it.");
+      return;
+    }
+    for (int i = 0; i < clouds.size(); ++i)
+    {
+      if (clouds[i].getType() != XmlRpc::XmlRpcValue::TypeString)
+      {
+        NODELET_ERROR("~clouds[%d] is not a topic name, ignoring it.", i);
+        continue;
+      }
+      fusion_inputs_.push_back(boost::shared_ptr<FusionInput>(new FusionInput(clouds[i])));
+    }
+  }
+
+  /** Reads the ~ring_elevations parameter into ring_elevations_. */
+  void loadRingElevations(ros::NodeHandle& private_nh)
+  {
+    XmlRpc::XmlRpcValue elevations;
+    if (!private_nh.getParam("ring_elevations", elevations))
+      return;
+    if (elevations.getType() != XmlRpc::XmlRpcValue::TypeArray)
+    {
+      NODELET_ERROR("~ring_elevations has to be a list of angles, ignoring it.");
+      return;
+    }
+    for (int i = 0; i < elevations.size(); ++i)
+    {
+      double elevation;
+      if (!xmlRpcNumber(elevations[i], elevation))
+      {
+        NODELET_ERROR("~ring_elevations[%d] is not a number, ignoring ~ring_elevations.", i);
+        ring_elevations_.clear();
+        return;
+      }
+      ring_elevations_.push_back(elevation * M_PI / 180.0);
+    }
+    NODELET_INFO("Skipping the rings of a %u ring lidar that can not reach the height slab.", (unsigned)ring_elevations_.size());
+  }
+
+  static bool xmlRpcNumber(XmlRpc::XmlRpcValue& value, double& number)
+  {
+    if (value.getType() == XmlRpc::XmlRpcValue::TypeDouble)
+      number = static_cast<double&>(value);
+    else if (value.getType() == XmlRpc::XmlRpcValue::TypeInt)
+      number = static_cast<int&>(value);
+    else
+      return false;
+    return true;
+  }
+
+  uint32_t numScanSubscribers() const
+  {
+    uint32_t subscribers = 0;
+    for (size_t i = 0; i < outputs_.size(); ++i)
+      subscribers += outputs_[i].pub.getNumSubscribers();
+    return subscribers;
+  }
+
   void connectCB() {
       boost::lock_guard<boost::mutex> lock(connect_mutex_);
-      if (pub_.getNumSubscribers() > 0) {
+      if (numScanSubscribers() > 0) {
           NODELET_DEBUG("Connecting to point cloud topic.");
-          sub_ = nh_.subscribe<PointCloud>("cloud", 10, &CloudToScan::callback, this);
+          if (!fusion_inputs_.empty())
+          {
+            for (size_t i = 0; i < fusion_inputs_.size(); ++i)
+              fusion_inputs_[i]->sub.subscribe(nh_, fusion_inputs_[i]->topic, 10);
+          }
+          else if (depth_image_)
+          {
+            info_sub_ = nh_.subscribe("camera_info", 1, &CloudToScan::cameraInfoCallback, this);
+            image_sub_.subscribe(nh_, "image", 10);
+          }
+          else
+          {
+            if (auto_row_band_)
+              info_sub_ = nh_.subscribe("camera_info", 1, &CloudToScan::cameraInfoCallback, this);
+            if (raw_cloud_)
+              raw_sub_.subscribe(nh_, "cloud", 10);
+            else
+              cloud_sub_.subscribe(nh_, "cloud", 10);
+          }
       }
   }
 
   void disconnectCB() {
       boost::lock_guard<boost::mutex> lock(connect_mutex_);
-      if (pub_.getNumSubscribers() == 0) {
+      if (numScanSubscribers() == 0) {
           NODELET_DEBUG("Unsubscribing from point cloud topic.");
-          sub_.shutdown();
+          raw_sub_.unsubscribe();
+          cloud_sub_.unsubscribe();
+          image_sub_.unsubscribe();
+          info_sub_.shutdown();
+          for (size_t i = 0; i < fusion_inputs_.size(); ++i)
+            fusion_inputs_[i]->sub.unsubscribe();
       }
   }
 
   void reconfigure(pointcloud_to_laserscan::CloudScanConfig &config, uint32_t level)
   {
-    min_height_ = config.min_height;
-    max_height_ = config.max_height;
-    angle_min_ = config.angle_min;
-    angle_max_ = config.angle_max;
-    angle_increment_ = config.angle_increment;
-    scan_time_ = config.scan_time;
-    range_min_ = config.range_min;
-    range_max_ = config.range_max;
+    // Build the new snapshot here and swap it in, callbacks keep using the
+    // one they started with until they are done with their cloud.
+    boost::shared_ptr<ScanConfig> scan_config(new ScanConfig());
+    scan_config->min_height = config.min_height;
+    scan_config->max_height = config.max_height;
+    scan_config->angle_min = config.angle_min;
+    scan_config->angle_max = config.angle_max;
+    scan_config->angle_increment = config.angle_increment;
+    scan_config->scan_time = config.scan_time;
+    scan_config->range_min = config.range_min;
+    scan_config->range_max = config.range_max;
+    scan_config->num_threads = config.num_threads;
+    scan_config->bands = bands_;
+    scan_config->generation = boost::atomic_load(&config_)->generation + 1;
+    scan_config->update();
 
-    range_min_sq_ = range_min_ * range_min_;
+    boost::atomic_store(&config_, ScanConfigConstPtr(scan_config));
   }
 
-  void callback(const PointCloud::ConstPtr& cloud)
+  void postCloud(const PointCloud::ConstPtr& cloud)
   {
-    sensor_msgs::LaserScanPtr output(new sensor_msgs::LaserScan());
-    output->header = cloud->header;
-    output->header.frame_id = output_frame_id_; // Set output frame. Point clouds come from "optical" frame, scans come from corresponding mount frame
-    output->angle_min = angle_min_;
-    output->angle_max = angle_max_;
-    output->angle_increment = angle_increment_;
-    output->time_increment = 0.0;
-    output->scan_time = scan_time_;
-    output->range_min = range_min_;
-    output->range_max = range_max_;
+    {
+      boost::lock_guard<boost::mutex> lock(mailbox_mutex_);
+      if (mailbox_cloud_)
+        countMailboxDrop();
+      mailbox_cloud_ = cloud;
+    }
+    mailbox_cond_.notify_one();
+  }
 
-    uint32_t ranges_size = std::ceil((output->angle_max - output->angle_min) / output->angle_increment);
-    output->ranges.assign(ranges_size, output->range_max + 1.0);
+  void postRawCloud(const sensor_msgs::PointCloud2::ConstPtr& cloud)
+  {
+    {
+      boost::lock_guard<boost::mutex> lock(mailbox_mutex_);
+      if (mailbox_raw_cloud_)
+        countMailboxDrop();
+      mailbox_raw_cloud_ = cloud;
+    }
+    mailbox_cond_.notify_one();
+  }
 
-    // transform from camera into reference frame
-    tf::StampedTransform cloud_to_ref;
-    try{
-      listener.waitForTransform(ref_frame_id_, cloud->header.frame_id, cloud->header.stamp, ros::Duration(1.0) );
-      listener.lookupTransform(ref_frame_id_, cloud->header.frame_id, cloud->header.stamp, cloud_to_ref);
+  void postImage(const sensor_msgs::Image::ConstPtr& image)
+  {
+    {
+      boost::lock_guard<boost::mutex> lock(mailbox_mutex_);
+      if (mailbox_image_)
+        countMailboxDrop();
+      mailbox_image_ = image;
     }
-    catch (tf::TransformException ex){
-      ROS_ERROR("%s",ex.what());
+    mailbox_cond_.notify_one();
+  }
+
+  // Expects mailbox_mutex_ to be held.
+  void countMailboxDrop()
+  {
+    ++mailbox_dropped_;
+    {
+      boost::lock_guard<boost::mutex> lock(stats_mutex_);
+      ++stats_.mailbox_dropped;
     }
+    NODELET_WARN_THROTTLE(5.0, "Processing falls behind, replaced %u unprocessed clouds with newer ones so far.", mailbox_dropped_);
+  }
 
-    // compute translation of virtual laser frame
-    // x,y come from camera frame
-    // z is between min/max height
-    tf::Vector3 ref_origin = cloud_to_ref.getOrigin();
-    ref_origin.setZ( (min_height_+max_height_)*0.5 );
-
-    // compute orientation of virtual laser frame
-    // rotation comes from the z axis of the optical camera frame
-    tf::Vector3 z_axis(0, 0, 1);
-    tf::Transform camera_rot(cloud_to_ref.getRotation());
-    tf::Vector3 rotated_z_axis = camera_rot * z_axis;
-    double alpha = atan2(rotated_z_axis.y(), rotated_z_axis.x());
-    tf::Quaternion ref_ori(tf::Vector3(0,0,1), alpha);
-
-    // transform from reference into 'virtual laser' output frame
-    tf::StampedTransform ref_to_out;
-    ref_to_out.frame_id_ = ref_frame_id_;
-    ref_to_out.child_frame_id_ = output_frame_id_;
-    ref_to_out.stamp_ = cloud->header.stamp;
-    ref_to_out.setOrigin( ref_origin );
-    ref_to_out.setRotation( ref_ori );
-    broadcaster.sendTransform( ref_to_out );
-
-    // transform from cloud into output frame at zero height
-    ref_origin.setZ( 0.0 );
-    ref_to_out.setOrigin( ref_origin );
-    tf::Transform cloud_to_out;
-    cloud_to_out.mult( ref_to_out.inverse(), cloud_to_ref );
+  void mailboxLoop()
+  {
+    while (true)
+    {
+      PointCloud::ConstPtr cloud;
+      sensor_msgs::PointCloud2::ConstPtr raw_cloud;
+      sensor_msgs::Image::ConstPtr image;
+      {
+        boost::unique_lock<boost::mutex> lock(mailbox_mutex_);
+        while (!mailbox_shutdown_ && !mailbox_cloud_ && !mailbox_raw_cloud_ && !mailbox_image_)
+          mailbox_cond_.wait(lock);
+        if (mailbox_shutdown_)
+          return;
+        cloud.swap(mailbox_cloud_);
+        raw_cloud.swap(mailbox_raw_cloud_);
+        image.swap(mailbox_image_);
+      }
+
+      if (cloud)
+        callback(cloud);
+      if (raw_cloud)
+        rawCallback(raw_cloud);
+      if (image)
+        depthCallback(image);
+    }
+  }
+
+  /**
+   * Pipeline mode: takes a free frame and queues binning it on the pipeline
+   * threads. The cloud is dropped if all frames are in flight or it is not
+   * newer than the last published scan.
+   */
+  template <class M>
+  void dispatchFrame(const boost::shared_ptr<M const>& message)
+  {
+    Frame* frame;
+    {
+      boost::lock_guard<boost::mutex> lock(sequencer_mutex_);
+      if (free_frames_.empty() || message->header.stamp <= last_published_stamp_)
+      {
+        countPipelineDrop();
+        return;
+      }
+      frame = free_frames_.back();
+      free_frames_.pop_back();
+      frame->done = frame->abandoned = frame->binned = false;
+      frame->stamp = message->header.stamp;
+      in_flight_.push_back(frame);
+    }
+    frame_pool_->post(boost::bind(&CloudToScan::runFrame<M>, this, frame, message));
+  }
+
+  template <class M>
+  void runFrame(Frame* frame, const boost::shared_ptr<M const>& message)
+  {
+    bool binned = binFrame(*frame, message);
+    boost::unique_lock<boost::mutex> lock(sequencer_mutex_);
+    frame->binned = binned;
+    completeFrame(frame);
+    publishReadyFrames(lock);
+  }
 
-    for (PointCloud::const_iterator it = cloud->begin(); it != cloud->end(); ++it)
+  /**
+   * Sequencer: queues the frames at the head of the pipeline that are done
+   * for publishing, in the order they were dispatched, and drops any that
+   * would break stamp order. A frame still binning while one stamped more
+   * than max_frame_lag later is done is given up on. Expects
+   * sequencer_mutex_ to be held.
+   */
+  void completeFrame(Frame* frame)
+  {
+    frame->done = true;
+    if (frame->abandoned)
     {
-      tf::Vector3 p(it->x,it->y,it->z);
-      p = cloud_to_out(p);
+      releaseFrame(frame);
+      return;
+    }
 
-      const float &x = p.x();
-      const float &y = p.y();
-      const float &z = p.z();
+    if (max_frame_lag_ > 0.0 && frame->binned)
+    {
+      while (!in_flight_.empty() && !in_flight_.front()->done &&
+             (frame->stamp - in_flight_.front()->stamp).toSec() > max_frame_lag_)
+      {
+        in_flight_.front()->abandoned = true; // released when its thread is done with it
+        in_flight_.pop_front();
+        countPipelineDrop();
+      }
+    }
 
-      if ( std::isnan(x) || std::isnan(y) || std::isnan(z) )
+    while (!in_flight_.empty() && in_flight_.front()->done)
+    {
+      Frame* next = in_flight_.front();
+      in_flight_.pop_front();
+      if (next->binned && next->stamp > last_published_stamp_)
       {
-        NODELET_DEBUG("rejected for nan in point(%f, %f, %f)\n", x, y, z);
+        ready_frames_.push_back(next);
+        last_published_stamp_ = next->stamp;
         continue;
       }
+      if (next->binned)
+        countPipelineDrop();
+      releaseFrame(next);
+    }
+  }
+
+  /**
+   * Publishes the queued frames without holding sequencer_mutex_, which lock
+   * holds on entry and exit. One thread publishes at a time so the scans go
+   * out in order; frames queued meanwhile are left to it.
+   */
+  void publishReadyFrames(boost::unique_lock<boost::mutex>& lock)
+  {
+    if (publishing_)
+      return;
+    publishing_ = true;
+    while (!ready_frames_.empty())
+    {
+      Frame* frame = ready_frames_.front();
+      ready_frames_.pop_front();
+      lock.unlock();
+      publishFrame(*frame);
+      lock.lock();
+      releaseFrame(frame);
+    }
+    publishing_ = false;
+  }
+
+  // Expects sequencer_mutex_ to be held.
+  void releaseFrame(Frame* frame)
+  {
+    frame->message.reset();
+    for (size_t i = 0; i < frame->scans.size(); ++i)
+      frame->scans[i].reset();
+    free_frames_.push_back(frame);
+  }
+
+  // Expects sequencer_mutex_ to be held.
+  void countPipelineDrop()
+  {
+    ++pipeline_dropped_;
+    {
+      boost::lock_guard<boost::mutex> lock(stats_mutex_);
+      ++stats_.pipeline_dropped;
+    }
+    NODELET_WARN_THROTTLE(5.0, "Dropped %u clouds that fell behind in the pipeline so far.", pipeline_dropped_);
+  }
+
+  void callback(const PointCloud::ConstPtr& cloud)
+  {
+    if (binFrame(frame_, cloud))
+      publishFrame(frame_);
+  }
+
+  /** Bins a cloud into the scans of frame, returns false if it had to be dropped. */
+  bool binFrame(Frame& frame, const PointCloud::ConstPtr& cloud)
+  {
+    FrameTimes& times = frame.times;
+    times.start = latencyTime();
+    frame.started = monotonicTime();
+    ScanConfigConstPtr config = boost::atomic_load(&config_);
+    if (!lookupCloudTransform(frame, cloud->header, *config))
+      return false;
+    const tf::Transform& cloud_to_out = frame.transform.cloud_to_out;
+    const double* transform = frame.transform.matrix;
+    times.lookup = latencyTime();
 
-      if (z > max_height_ || z < min_height_)
+    PointCounts& counts = frame.counts;
+    counts = PointCounts();
+    Coverage& coverage = frame.coverage;
+    coverage = Coverage();
+    double binning_start = 0.0;
+    uint64_t allocations = trackedAllocations();
+    {
+      ScopedAllocationTracking tracking;
+      makeScans(frame, cloud->header, *config);
+      binning_start = monotonicTime();
+
+      const bool organized = cloud->height > 1 && cloud->points.size() == (size_t)cloud->width * cloud->height;
+      PixelBin* bins = organized ? cloudTable(*config, cloud_to_out, cloud->width, cloud->height) : NULL;
+      if (bins)
+      {
+        const float height_offset = cloud_to_out.getOrigin().z();
+        const PixelRegion region = pixelRegion(*config, cloud->width, cloud->height, transform);
+        coverage.total = regionSize(region);
+        for (size_t pass = 0; pass < numPasses() && budgetLeft(pass, binning_start); ++pass)
+        {
+          const PixelRegion sub = interleavedRegion(region, pass, numPasses());
+          for (uint32_t row = sub.row_begin; row < sub.row_end; row += sub.row_stride)
+          {
+            for (uint32_t col = sub.col_begin; col < sub.col_end; col += sub.col_stride)
+            {
+              const size_t i = (size_t)row * cloud->width + col;
+              addPixel(*config, bins[i], transform, height_offset, cloud->points[i].x, cloud->points[i].y, cloud->points[i].z, &frame.scan_ranges[0], counts);
+            }
+          }
+          coverage.processed += regionSize(sub);
+        }
+      }
+      else if (organized)
       {
-        NODELET_DEBUG("rejected for height %f not in range (%f, %f)\n", p.z(), min_height_, max_height_);
+        CloudView view;
+        view.data = reinterpret_cast<const uint8_t*>(&cloud->points[0].x);
+        view.point_step = sizeof(pcl::PointXYZ);
+        view.row_step = cloud->width * sizeof(pcl::PointXYZ);
+        view.width = cloud->width;
+        view.height = cloud->height;
+        view.dense = cloud->is_dense;
+        projectPasses(frame, view, pixelRegion(*config, cloud->width, cloud->height, transform), transform, *config,
+                      binning_start, coverage, counts);
+      }
+      else if (!cloud->points.empty())
+      {
+        CloudView view;
+        view.data = reinterpret_cast<const uint8_t*>(&cloud->points[0].x);
+        view.point_step = sizeof(pcl::PointXYZ);
+        view.row_step = cloud->points.size() * sizeof(pcl::PointXYZ);
+        view.width = cloud->points.size();
+        view.height = 1;
+        view.dense = cloud->is_dense;
+        projectPasses(frame, view, pixelRegion(*config, view.width, 1, transform), transform, *config, binning_start, coverage, counts);
+      }
+    }
+    times.binning = latencyTime();
+    checkAllocations(*config, trackedAllocations() - allocations);
+    frame.message = cloud;
+    frame.stamp = cloud->header.stamp;
+    return true;
+  }
+
+  /**
+   * Finds the float32 x/y/z fields of a serialized cloud and checks that its
+   * buffer holds all points. Logs why and returns false if it cannot be used.
+   */
+  bool checkRawCloud(const sensor_msgs::PointCloud2& cloud, int& x_offset, int& y_offset, int& z_offset)
+  {
+    x_offset = y_offset = z_offset = -1;
+    for (size_t i = 0; i < cloud.fields.size(); ++i)
+    {
+      const sensor_msgs::PointField& field = cloud.fields[i];
+      if (field.datatype != sensor_msgs::PointField::FLOAT32 || (uint64_t)field.offset + 4 > cloud.point_step)
         continue;
+      if (field.name == "x")
+        x_offset = field.offset;
+      else if (field.name == "y")
+        y_offset = field.offset;
+      else if (field.name == "z")
+        z_offset = field.offset;
+    }
+
+    if (x_offset < 0 || y_offset < 0 || z_offset < 0)
+    {
+      NODELET_ERROR("Point cloud has no float32 x/y/z fields, dropping it.");
+      return false;
+    }
+    if (cloud.is_bigendian)
+    {
+      NODELET_ERROR("Big endian point clouds are not supported, dropping it.");
+      return false;
+    }
+    // in 64 bits, the 32 bit products of the header fields can wrap
+    if ((uint64_t)cloud.width * cloud.point_step > cloud.row_step ||
+        (uint64_t)cloud.height * cloud.row_step > cloud.data.size())
+    {
+      NODELET_ERROR("Point cloud data is smaller than its width, height and steps claim, dropping it.");
+      return false;
+    }
+    return true;
+  }
+
+  void rawCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud)
+  {
+    if (binFrame(frame_, cloud))
+      publishFrame(frame_);
+  }
+
+  /** Bins a serialized cloud into the scans of frame, returns false if it had to be dropped. */
+  bool binFrame(Frame& frame, const sensor_msgs::PointCloud2::ConstPtr& cloud)
+  {
+    FrameTimes& times = frame.times;
+    times.start = latencyTime();
+    frame.started = monotonicTime();
+    int x_offset, y_offset, z_offset;
+    if (!checkRawCloud(*cloud, x_offset, y_offset, z_offset))
+      return false;
+
+    ScanConfigConstPtr config = boost::atomic_load(&config_);
+    if (!lookupCloudTransform(frame, cloud->header, *config))
+      return false;
+    const tf::Transform& cloud_to_out = frame.transform.cloud_to_out;
+    const double* transform = frame.transform.matrix;
+    times.lookup = latencyTime();
+
+    PointCounts& counts = frame.counts;
+    counts = PointCounts();
+    Coverage& coverage = frame.coverage;
+    coverage = Coverage();
+    double binning_start = 0.0;
+    uint64_t allocations = trackedAllocations();
+    {
+      ScopedAllocationTracking tracking;
+      makeScans(frame, cloud->header, *config);
+      binning_start = monotonicTime();
+
+      PixelBin* bins = cloudTable(*config, cloud_to_out, cloud->width, cloud->height);
+      const float height_offset = cloud_to_out.getOrigin().z();
+      const PixelRegion region = pixelRegion(*config, cloud->width, cloud->height, transform);
+
+      int ring_offset = -1;
+      size_t ring_size = 0;
+      if (cloud->height == 1 && !ring_elevations_.empty())
+      {
+        if (findRingField(*cloud, ring_offset, ring_size))
+        {
+          frame.ring_intervals.resize(ring_elevations_.size());
+          for (size_t ring = 0; ring < ring_elevations_.size(); ++ring)
+            frame.ring_intervals[ring] = ringInterval(ring_elevations_[ring], transform, *config, config->range_max);
+        }
+        else
+          NODELET_WARN_THROTTLE(5.0, "Unorganized cloud has no uint8 or uint16 ring field, processing all rings.");
+      }
+
+      if (cloud->data.empty())
+      {
+        // no points, the scans stay empty; &data[0] would be undefined
+      }
+      else if (!bins && ring_offset < 0 && y_offset == x_offset + 4 && z_offset == x_offset + 8)
+      {
+        // x/y/z packed next to each other, as in every common layout, go through the filter kernel
+        // compiled for the cloud's point step
+        CloudView view;
+        view.data = &cloud->data[0] + x_offset;
+        view.point_step = cloud->point_step;
+        view.row_step = cloud->row_step;
+        view.width = cloud->width;
+        view.height = cloud->height;
+        view.dense = cloud->is_dense;
+        projectPasses(frame, view, region, transform, *config, binning_start, coverage, counts);
+      }
+      else
+      {
+        // Walk the serialized buffer directly; rows may be padded beyond width * point_step.
+        coverage.total = regionSize(region);
+        for (size_t pass = 0; pass < numPasses() && budgetLeft(pass, binning_start); ++pass)
+        {
+          const PixelRegion sub = interleavedRegion(region, pass, numPasses());
+          for (uint32_t row = sub.row_begin; row < sub.row_end; row += sub.row_stride)
+          {
+            const uint8_t* ptr = &cloud->data[0] + row * cloud->row_step + sub.col_begin * cloud->point_step;
+            for (uint32_t col = sub.col_begin; col < sub.col_end; col += sub.col_stride, ptr += sub.col_stride * cloud->point_step)
+            {
+              if (ring_offset >= 0 && !ringMayContribute(frame.ring_intervals, ptr, ring_offset, ring_size,
+                                                         x_offset, y_offset, z_offset))
+                ++counts.height;
+              else if (bins)
+                addPixel(*config, bins[row * cloud->width + col], transform, height_offset,
+                         readFloat(ptr + x_offset), readFloat(ptr + y_offset), readFloat(ptr + z_offset), &frame.scan_ranges[0], counts);
+              else
+                projectPoint(*config, transform, readFloat(ptr + x_offset), readFloat(ptr + y_offset), readFloat(ptr + z_offset),
+                             &frame.scan_ranges[0], counts);
+            }
+          }
+          coverage.processed += regionSize(sub);
+        }
       }
+    }
+    times.binning = latencyTime();
+    checkAllocations(*config, trackedAllocations() - allocations);
+    frame.message = cloud;
+    frame.stamp = cloud->header.stamp;
+    return true;
+  }
+
+  void fusionCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud, size_t input)
+  {
+    boost::lock_guard<boost::mutex> lock(fusion_mutex_);
+    const ros::Time& stamp = cloud->header.stamp;
+    // A late cloud of an already published window would open a new window
+    // with an older stamp and send the scans back in time.
+    if (stamp < fusion_published_stamp_ || stamp + fusion_window_ < fusion_window_start_)
+    {
+      NODELET_WARN_THROTTLE(5.0, "Cloud from %s is older than the last fused scan, dropping it.",
+                            fusion_inputs_[input]->topic.c_str());
+      return;
+    }
+
+    // A sensor delivering its next frame or a frame outside the window closes
+    // the window, so a dead sensor delays the others by at most one frame.
+    if (fusion_pending_ > 0 && (fusion_inputs_[input]->cloud || stamp > fusion_window_start_ + fusion_window_))
+      processFusionWindow();
+    if (fusion_pending_ == 0)
+      fusion_window_start_ = stamp;
+
+    fusion_inputs_[input]->cloud = cloud;
+    if (++fusion_pending_ == fusion_inputs_.size())
+      processFusionWindow();
+  }
 
-      double range_sq = y*y+x*x;
-      if (range_sq < range_min_sq_) {
-        NODELET_DEBUG("rejected for range %f below minimum value %f. Point: (%f, %f, %f)", range_sq, range_min_sq_, x, y, z);
+  /**
+   * Projects the clouds collected in the current sync window, one sensor per
+   * worker, and publishes the min-reduced scans. Expects fusion_mutex_ to be
+   * held.
+   */
+  void processFusionWindow()
+  {
+    Frame& frame = frame_;
+    FrameTimes& times = frame.times;
+    times.start = latencyTime();
+    frame.started = monotonicTime();
+    ScanConfigConstPtr config = boost::atomic_load(&config_);
+
+    // the scans carry the newest stamp, latencies are those of the oldest cloud
+    const sensor_msgs::PointCloud2* newest = NULL;
+    const sensor_msgs::PointCloud2::ConstPtr* oldest = NULL;
+    for (size_t i = 0; i < fusion_inputs_.size(); ++i)
+    {
+      const sensor_msgs::PointCloud2::ConstPtr& cloud = fusion_inputs_[i]->cloud;
+      if (!cloud)
         continue;
+      if (!newest || cloud->header.stamp > newest->header.stamp)
+        newest = cloud.get();
+      if (!oldest || cloud->header.stamp < (*oldest)->header.stamp)
+        oldest = &cloud;
+    }
+    times.lookup = latencyTime();
+
+    PointCounts& counts = frame.counts;
+    counts = PointCounts();
+    frame.coverage = Coverage();
+    uint64_t allocations = trackedAllocations();
+    {
+      ScopedAllocationTracking tracking;
+      makeScans(frame, newest->header, *config);
+
+      fusion_config_ = config.get();
+      fusion_pool_->parallelFor(fusion_inputs_.size(), project_input_);
+      fusion_config_ = NULL;
+
+      for (size_t i = 0; i < fusion_inputs_.size(); ++i)
+      {
+        FusionInput& input = *fusion_inputs_[i];
+        if (!input.projected)
+          continue;
+        counts.add(input.counts);
+        mergeRanges(&frame.scan_ranges[0], &input.scan_ranges[0], *config);
       }
+    }
+    times.binning = latencyTime();
+    checkAllocations(*config, trackedAllocations() - allocations);
+
+    broadcastBandFrames(frame, newest->header.stamp, *config);
+    fusion_published_stamp_ = newest->header.stamp;
+    frame.message = *oldest;
+    frame.stamp = (*oldest)->header.stamp;
+    publishFrame(frame);
+
+    for (size_t i = 0; i < fusion_inputs_.size(); ++i)
+      fusion_inputs_[i]->cloud.reset();
+    fusion_pending_ = 0;
+  }
+
+  /** Projects the cloud of one sensor into its private ranges, runs on the fusion workers. */
+  void projectFusionInput(size_t index)
+  {
+    // tracking is per thread, the caller's does not cover the workers
+    ScopedAllocationTracking tracking;
+    FusionInput& input = *fusion_inputs_[index];
+    const ScanConfig& config = *fusion_config_;
+    input.projected = false;
+    input.counts = PointCounts();
+    if (!input.cloud)
+      return;
+
+    const sensor_msgs::PointCloud2& cloud = *input.cloud;
+    int x_offset, y_offset, z_offset;
+    if (!checkRawCloud(cloud, x_offset, y_offset, z_offset) || cloud.data.empty())
+      return;
+    if (y_offset != x_offset + 4 || z_offset != x_offset + 8)
+    {
+      NODELET_ERROR_THROTTLE(5.0, "Cloud from %s does not have packed x/y/z fields, fusion needs them. Dropping it.",
+                             input.topic.c_str());
+      return;
+    }
+
+    // the scans are computed in the output frame itself
+    bool changed;
+    if (!cacheTransform(input.transform, output_frame_id_, cloud.header, changed))
+      return;
+    if (changed)
+    {
+      input.transform.cloud_to_out = input.transform.lookup;
+      toMatrix(input.transform.cloud_to_out, input.transform.matrix);
+    }
+
+    const size_t num_scans = config.numScans();
+    input.ranges.assign(num_scans * config.ranges_size, config.range_max + 1.0);
+    input.scan_ranges.resize(num_scans);
+    for (size_t scan = 0; scan < num_scans; ++scan)
+      input.scan_ranges[scan] = &input.ranges[scan * config.ranges_size];
+
+    CloudView view;
+    view.data = &cloud.data[0] + x_offset;
+    view.point_step = cloud.point_step;
+    view.row_step = cloud.row_step;
+    view.width = cloud.width;
+    view.height = cloud.height;
+    view.dense = cloud.is_dense;
+    input.projector.project(view, input.transform.matrix, config, &input.scan_ranges[0], input.counts);
+    input.projected = true;
+  }
+
+  /**
+   * In fusion mode the scans are computed in the output frame itself. Band
+   * frames other than the output frame are broadcast as children of it at the
+   * band's mid height.
+   */
+  void broadcastBandFrames(Frame& frame, const ros::Time& stamp, const ScanConfig& config)
+  {
+    std::vector<tf::StampedTransform>& laser_frames = frame.laser_frames;
+    laser_frames.resize(outputs_.size());
+    size_t num_frames = 0;
+    for (size_t i = 0; i < outputs_.size(); ++i)
+    {
+      if (outputs_[i].frame_id == output_frame_id_)
+        continue;
+      tf::StampedTransform& out_to_band = laser_frames[num_frames++];
+      out_to_band.frame_id_ = output_frame_id_;
+      out_to_band.child_frame_id_ = outputs_[i].frame_id;
+      out_to_band.stamp_ = stamp;
+      out_to_band.setOrigin( tf::Vector3(0, 0, (config.bands[i].min_height+config.bands[i].max_height)*0.5) );
+      out_to_band.setRotation( tf::Quaternion(0, 0, 0, 1) );
+    }
+    laser_frames.resize(num_frames);
+    sendLaserFrames(laser_frames);
+  }
+
+  /**
+   * Sends the virtual laser frames right away, or in timed mode hands them to
+   * the broadcast timer if one of them moved by more than the threshold since
+   * they were last handed over.
+   */
+  void sendLaserFrames(const std::vector<tf::StampedTransform>& laser_frames)
+  {
+    if (laser_frames.empty())
+      return;
+    if (frame_period_ <= 0.0)
+    {
+      broadcaster.sendTransform( laser_frames );
+      return;
+    }
+
+    boost::lock_guard<boost::mutex> lock(frame_mutex_);
+    bool moved = broadcast_frames_.size() != laser_frames.size();
+    for (size_t i = 0; i < broadcast_frames_.size() && !moved; ++i)
+      moved = broadcast_frames_[i].child_frame_id_ != laser_frames[i].child_frame_id_ ||
+              !withinTolerance(broadcast_frames_[i], laser_frames[i], frame_threshold_);
+    if (moved)
+      broadcast_frames_ = laser_frames;
+  }
 
-      double angle = -atan2(-y, x);
-      if (angle < output->angle_min || angle > output->angle_max)
+  /**
+   * Timed mode: broadcasts the latest virtual laser frames stamped one period
+   * into the future, as static_transform_publisher does, so lookups up to the
+   * next broadcast need no extrapolation.
+   */
+  void broadcastFrames(const ros::TimerEvent&)
+  {
+    boost::lock_guard<boost::mutex> lock(frame_mutex_);
+    if (broadcast_frames_.empty())
+      return;
+    ros::Time stamp = ros::Time::now() + ros::Duration(frame_period_);
+    for (size_t i = 0; i < broadcast_frames_.size(); ++i)
+      broadcast_frames_[i].stamp_ = stamp;
+    broadcaster.sendTransform( broadcast_frames_ );
+  }
+
+  void cameraInfoCallback(const sensor_msgs::CameraInfo::ConstPtr& info)
+  {
+    boost::atomic_store(&camera_info_, info);
+  }
+
+  void depthCallback(const sensor_msgs::Image::ConstPtr& image)
+  {
+    if (binFrame(frame_, image))
+      publishFrame(frame_);
+  }
+
+  /** Bins a depth image into the scans of frame, returns false if it had to be dropped. */
+  bool binFrame(Frame& frame, const sensor_msgs::Image::ConstPtr& image)
+  {
+    FrameTimes& times = frame.times;
+    times.start = latencyTime();
+    frame.started = monotonicTime();
+
+    sensor_msgs::CameraInfo::ConstPtr info = boost::atomic_load(&camera_info_);
+    if (!info)
+    {
+      NODELET_WARN_THROTTLE(5.0, "No camera info received yet, dropping depth images.");
+      return false;
+    }
+    if (info->width != image->width || info->height != image->height || !(info->K[0] > 0.0) || !(info->K[4] > 0.0))
+    {
+      NODELET_ERROR_THROTTLE(5.0, "Camera info does not match the %ux%u depth image, dropping it.", image->width, image->height);
+      return false;
+    }
+
+    size_t depth_size;
+    if (image->encoding == sensor_msgs::image_encodings::TYPE_16UC1)
+      depth_size = sizeof(uint16_t);
+    else if (image->encoding == sensor_msgs::image_encodings::TYPE_32FC1)
+      depth_size = sizeof(float);
+    else
+    {
+      NODELET_ERROR("Depth image encoding %s is not supported, dropping it.", image->encoding.c_str());
+      return false;
+    }
+    if (image->is_bigendian)
+    {
+      NODELET_ERROR("Big endian depth images are not supported, dropping it.");
+      return false;
+    }
+    if ((uint64_t)image->width * depth_size > image->step || (uint64_t)image->height * image->step > image->data.size())
+    {
+      NODELET_ERROR("Depth image data is smaller than its width, height and step claim, dropping it.");
+      return false;
+    }
+
+    ScanConfigConstPtr config = boost::atomic_load(&config_);
+    if (!lookupCloudTransform(frame, image->header, *config))
+      return false;
+    const tf::Transform& cloud_to_out = frame.transform.cloud_to_out;
+    times.lookup = latencyTime();
+
+    PointCounts& counts = frame.counts;
+    counts = PointCounts();
+    Coverage& coverage = frame.coverage;
+    coverage = Coverage();
+    double binning_start = 0.0;
+    uint64_t allocations = trackedAllocations();
+    {
+      ScopedAllocationTracking tracking;
+      makeScans(frame, image->header, *config);
+      binning_start = monotonicTime();
+
+      const PixelBin* bins = updateDepthTable(*config, cloud_to_out, *info);
+      const float height_offset = cloud_to_out.getOrigin().z();
+      const PixelRegion region = pixelRegion(*config, image->width, image->height, frame.transform.matrix);
+      coverage.total = regionSize(region);
+      for (size_t pass = 0; pass < numPasses() && !region.empty() && budgetLeft(pass, binning_start); ++pass)
+      {
+        // region is empty for an image without data, whose &data[0] would be undefined
+        const PixelRegion sub = interleavedRegion(region, pass, numPasses());
+        if (depth_size == sizeof(uint16_t))
+          binDepthImage<uint16_t>(*config, &image->data[0], image->step, image->width, sub, bins, height_offset,
+                                  &frame.scan_ranges[0], counts);
+        else
+          binDepthImage<float>(*config, &image->data[0], image->step, image->width, sub, bins, height_offset,
+                               &frame.scan_ranges[0], counts);
+        coverage.processed += regionSize(sub);
+      }
+    }
+    times.binning = latencyTime();
+    checkAllocations(*config, trackedAllocations() - allocations);
+    frame.message = image;
+    frame.stamp = image->header.stamp;
+    return true;
+  }
+
+  /**
+   * Smooths the period between the stamps of incoming clouds. Measured on
+   * arrival, so clouds dropped later do not make the input look slower.
+   */
+  void recordInputStamp(const ros::Time& stamp)
+  {
+    boost::lock_guard<boost::mutex> lock(load_mutex_);
+    if (!last_input_stamp_.isZero() && stamp > last_input_stamp_)
+    {
+      const double period = (stamp - last_input_stamp_).toSec();
+      input_period_ = input_period_ > 0.0 ? (1.0 - LOAD_SMOOTHING) * input_period_ + LOAD_SMOOTHING * period : period;
+    }
+    last_input_stamp_ = stamp;
+  }
+
+  /**
+   * Overload control: compares the time from the start of a frame until
+   * its scans are published with the period of the input times the number
+   * of frames binned at once, both smoothed, and
+   * doubles the column stride while the load is above target_load, up to
+   * max_load_stride. Once the load at half the stride would be well below
+   * the target it backs off again.
+   */
+  void updateLoad(double frame_time)
+  {
+    if (max_load_stride_ <= 1)
+      return;
+
+    boost::lock_guard<boost::mutex> load_lock(load_mutex_);
+    // with a pipeline, each frame may take as many input periods as there are threads binning
+    const double frame_period = input_period_ * binning_threads_;
+    frame_time_ = frame_time_ > 0.0 ? (1.0 - LOAD_SMOOTHING) * frame_time_ + LOAD_SMOOTHING * frame_time : frame_time;
+    if (frame_period <= 0.0)
+      return;
+
+    const double load = frame_time_ / frame_period;
+    const uint32_t stride = load_stride_;
+    if (++frames_at_stride_ >= LOAD_SETTLE_FRAMES)
+    {
+      if (load > target_load_ && load_stride_ < (uint32_t)max_load_stride_)
       {
-        NODELET_DEBUG("rejected for angle %f not in range (%f, %f)\n", angle, output->angle_min, output->angle_max);
+        load_stride_ = std::min(2 * load_stride_, (uint32_t)max_load_stride_);
+        NODELET_WARN("Frames take %.1f ms of the %.1f ms available to each, raising the stride to %u.",
+                     frame_time_ * 1e3, frame_period * 1e3, load_stride_);
+      }
+      else if (load * 2.0 < 0.7 * target_load_ && load_stride_ > 1)
+      {
+        load_stride_ /= 2;
+        NODELET_INFO("Frames take %.1f ms of the %.1f ms available to each, lowering the stride to %u.",
+                     frame_time_ * 1e3, frame_period * 1e3, load_stride_);
+      }
+    }
+    if (load_stride_ != stride)
+    {
+      // the cost scales with the points binned
+      frame_time_ *= (double)stride / load_stride_;
+      frames_at_stride_ = 0;
+    }
+
+    boost::lock_guard<boost::mutex> lock(stats_mutex_);
+    stats_.load = load;
+    stats_.load_stride = load_stride_;
+    stats_.stride_changes += load_stride_ != stride;
+  }
+
+  /** Points of a frame processed, for the anytime mode. */
+  struct Coverage
+  {
+    Coverage(): processed(0), total(0) {}
+    double fraction() const { return total > 0 ? (double)processed / total : 1.0; }
+    size_t processed, total;
+  };
+
+  /**
+   * Anytime mode: with a time_budget, frames are processed in interleaved
+   * passes, see interleavedRegion(), until the budget is used up. The first
+   * pass is always completed, so every bin gets a candidate.
+   */
+  size_t numPasses() const { return time_budget_ > 0.0 ? anytime_passes_ : 1; }
+
+  bool budgetLeft(size_t pass, double start) const
+  {
+    return pass == 0 || monotonicTime() - start < time_budget_;
+  }
+
+  /** Projects region of view through the filter kernel in anytime passes. */
+  void projectPasses(Frame& frame, const CloudView& view, const PixelRegion& region, const double* transform,
+                     const ScanConfig& config, double start, Coverage& coverage, PointCounts& counts)
+  {
+    coverage.total = regionSize(region);
+    for (size_t pass = 0; pass < numPasses() && budgetLeft(pass, start); ++pass)
+    {
+      const PixelRegion sub = interleavedRegion(region, pass, numPasses());
+      frame.projector.project(regionView(view, sub), transform, config, &frame.scan_ranges[0], counts);
+      coverage.processed += regionSize(sub);
+    }
+  }
+
+  /**
+   * Pixels of an organized cloud or depth image to process: the region of
+   * interest and strides, with the rows that can not reach the slab cut off
+   * if auto_row_band is set and camera info for this image size arrived.
+   * Unorganized clouds are processed completely.
+   */
+  PixelRegion pixelRegion(const ScanConfig& config, uint32_t width, uint32_t height, const double* transform)
+  {
+    PixelRegion region(width, height);
+    {
+      boost::lock_guard<boost::mutex> lock(load_mutex_);
+      region.col_stride = load_stride_;
+    }
+    if (height <= 1)
+      return region;
+
+    region.col_begin = std::min((uint32_t)roi_x_offset_, width);
+    region.row_begin = std::min((uint32_t)roi_y_offset_, height);
+    if (roi_width_ > 0)
+      region.col_end = std::min(region.col_begin + (uint32_t)roi_width_, width);
+    if (roi_height_ > 0)
+      region.row_end = std::min(region.row_begin + (uint32_t)roi_height_, height);
+    region.col_stride *= col_stride_;
+    region.row_stride = row_stride_;
+
+    if (auto_row_band_)
+    {
+      sensor_msgs::CameraInfo::ConstPtr info = boost::atomic_load(&camera_info_);
+      if (info && info->width == width && info->height == height && info->K[0] > 0.0 && info->K[4] > 0.0)
+      {
+        CameraIntrinsics camera;
+        camera.fx = info->K[0];
+        camera.cx = info->K[2];
+        camera.fy = info->K[4];
+        camera.cy = info->K[5];
+        limitRowsToSlab(region, camera, transform, config, config.range_max);
+      }
+      else
+        NODELET_WARN_THROTTLE(5.0, "No camera info for %ux%u images, processing all rows.", width, height);
+    }
+
+    if (height == ring_elevations_.size())
+      limitRowsToRings(region, ring_elevations_, transform, config, config.range_max);
+    else if (!ring_elevations_.empty())
+      NODELET_WARN_THROTTLE(5.0, "Cloud has %u rows but %u ring_elevations, processing all rows.", height,
+                            (unsigned)ring_elevations_.size());
+    return region;
+  }
+
+  /**
+   * Finds the ring field of a serialized lidar cloud and its size in bytes.
+   * Returns false if it has none that can be used.
+   */
+  bool findRingField(const sensor_msgs::PointCloud2& cloud, int& offset, size_t& size)
+  {
+    for (size_t i = 0; i < cloud.fields.size(); ++i)
+    {
+      const sensor_msgs::PointField& field = cloud.fields[i];
+      if (field.name != "ring")
         continue;
+      if ((field.datatype == sensor_msgs::PointField::UINT8 && field.offset + 1 <= cloud.point_step) ||
+          (field.datatype == sensor_msgs::PointField::UINT16 && field.offset + 2 <= cloud.point_step))
+      {
+        offset = field.offset;
+        size = field.datatype == sensor_msgs::PointField::UINT8 ? 1 : 2;
+        return true;
       }
-      int index = (angle - output->angle_min) / output->angle_increment;
+    }
+    return false;
+  }
+
+  void publishFrame(Frame& frame)
+  {
+    recordStatistics(frame);
+    frame.times.publish = latencyTime();
+    publishScans(frame);
+    updateLoad(monotonicTime() - frame.started);
+    recordLatencies(frame.message.get(), frame.stamp, frame.times);
+    frame.message.reset();
+  }
+
+  /**
+   * In builds with CLOUD_TO_SCAN_COUNT_ALLOCATIONS, aborts if generating a
+   * scan allocated once the first few clouds after a reconfigure have warmed
+   * up all buffers.
+   */
+  void checkAllocations(const ScanConfig& config, uint64_t allocations)
+  {
+#ifdef CLOUD_TO_SCAN_COUNT_ALLOCATIONS
+    boost::lock_guard<boost::mutex> lock(allocation_check_mutex_);
+    if (config.generation != allocation_check_generation_)
+    {
+      allocation_check_generation_ = config.generation;
+      allocation_check_frames_ = 0;
+    }
+    if (allocation_check_frames_ < ALLOCATION_WARMUP_FRAMES)
+    {
+      ++allocation_check_frames_;
+      return;
+    }
+    if (allocations > 0)
+    {
+      NODELET_FATAL("Generating a scan allocated %lu times in steady state.", (unsigned long)allocations);
+      ROS_BREAK();
+    }
+#endif
+  }
+
+  /** Row-major 3x4 matrix of a transform, as the projection takes it. */
+  static void toMatrix(const tf::Transform& transform, double* matrix)
+  {
+    const tf::Matrix3x3& basis = transform.getBasis();
+    const tf::Vector3& origin = transform.getOrigin();
+    for (int i = 0; i < 3; ++i)
+    {
+      matrix[4*i + 0] = basis[i].x();
+      matrix[4*i + 1] = basis[i].y();
+      matrix[4*i + 2] = basis[i].z();
+      matrix[4*i + 3] = origin[i];
+    }
+  }
+
+  /** Latency histograms of the processing stages, in seconds. */
+  struct Latencies
+  {
+    LatencyHistogram receive; // from receipt by roscpp to the subscriber callback: queueing and deserialization
+    LatencyHistogram tf_wait; // from the subscriber callback until processing starts
+    LatencyHistogram lookup;  // checking the cloud, looking up and broadcasting transforms
+    LatencyHistogram binning;
+    LatencyHistogram publish;
+    LatencyHistogram age;     // from the cloud stamp until the scan is published
+  };
+
+  /** Counters accumulated between two statistics messages. */
+  struct Statistics
+  {
+    Statistics(): clouds(0), scans(0), hit_bins(0), coverage_sum(0.0), min_coverage(1.0), cut_short(0),
+                  load(0.0), load_stride(1), stride_changes(0), tf_dropped(0), tf_expired(0), mailbox_dropped(0),
+                  pipeline_dropped(0) {}
+
+    uint64_t clouds;
+    uint64_t scans; // published, one per cloud and band
+    PointCounts points;
+    uint64_t hit_bins; // bins with a return, summed over all scans
+    double coverage_sum, min_coverage; // fraction of the points processed within time_budget
+    uint64_t cut_short;
+    double load;          // smoothed frame time over input period, latest value
+    uint32_t load_stride; // latest value
+    uint64_t stride_changes;
+    uint64_t tf_dropped, tf_expired, mailbox_dropped, pipeline_dropped;
+    Latencies latency;
+  };
+
+  /** Monotonic times at which one cloud entered the processing stages. */
+  struct FrameTimes
+  {
+    double start, lookup, binning, publish;
+  };
+
+  /** A cloud seen by the subscriber, kept until it has been processed. */
+  struct Arrival
+  {
+    const void* cloud;
+    double time;    // monotonic
+    double receive; // seconds since roscpp received it
+  };
+
+  /** Monotonic time for the latency statistics, 0 when they are disabled. */
+  double latencyTime() const
+  {
+    return LATENCY_STATS_BUILT && stats_rate_ > 0.0 ? monotonicTime() : 0.0;
+  }
+
+  template <class M>
+  void recordArrival(const ros::MessageEvent<M const>& event)
+  {
+    if (max_load_stride_ > 1 && fusion_inputs_.empty())
+      recordInputStamp(event.getMessage()->header.stamp);
+
+    if (!LATENCY_STATS_BUILT || stats_rate_ <= 0.0)
+      return;
+
+    Arrival arrival;
+    arrival.cloud = event.getMessage().get();
+    arrival.time = monotonicTime();
+    arrival.receive = (ros::Time::now() - event.getReceiptTime()).toSec();
+
+    boost::lock_guard<boost::mutex> lock(arrival_mutex_);
+    arrivals_[arrival_next_] = arrival;
+    arrival_next_ = (arrival_next_ + 1) % ARRIVAL_RING_SIZE;
+  }
 
-      if (output->ranges[index] * output->ranges[index] > range_sq)
-        output->ranges[index] = sqrt(range_sq);
+  /**
+   * Removes the arrival of the given cloud from the ring, searching from the
+   * newest entry. Clouds that waited while the ring wrapped are not found.
+   */
+  bool takeArrival(const void* cloud, Arrival& arrival)
+  {
+    boost::lock_guard<boost::mutex> lock(arrival_mutex_);
+    for (size_t i = 1; i <= ARRIVAL_RING_SIZE; ++i)
+    {
+      Arrival& entry = arrivals_[(arrival_next_ + ARRIVAL_RING_SIZE - i) % ARRIVAL_RING_SIZE];
+      if (entry.cloud == cloud)
+      {
+        arrival = entry;
+        entry.cloud = NULL;
+        return true;
       }
+    }
+    return false;
+  }
+
+  void recordLatencies(const void* cloud, const ros::Time& stamp, const FrameTimes& times)
+  {
+    if (!LATENCY_STATS_BUILT || stats_rate_ <= 0.0)
+      return;
+
+    double done = monotonicTime();
+    double age = (ros::Time::now() - stamp).toSec();
+    Arrival arrival;
+    bool arrived = takeArrival(cloud, arrival);
+
+    boost::lock_guard<boost::mutex> lock(stats_mutex_);
+    Latencies& latency = stats_.latency;
+    if (arrived)
+    {
+      latency.receive.record(arrival.receive);
+      latency.tf_wait.record(times.start - arrival.time);
+    }
+    latency.lookup.record(times.lookup - times.start);
+    latency.binning.record(times.binning - times.lookup);
+    latency.publish.record(done - times.publish);
+    latency.age.record(age);
+  }
+
+  void recordStatistics(const Frame& frame)
+  {
+    if (stats_rate_ <= 0.0)
+      return;
+
+    const PointCounts& counts = frame.counts;
+    const Coverage& coverage = frame.coverage;
+    uint64_t hit_bins = 0;
+    for (size_t i = 0; i < frame.scans.size(); ++i)
+    {
+      const sensor_msgs::LaserScan& scan = *frame.scans[i];
+      for (size_t j = 0; j < scan.ranges.size(); ++j)
+        hit_bins += scan.ranges[j] <= scan.range_max;
+    }
 
-    pub_.publish(output);
+    boost::lock_guard<boost::mutex> lock(stats_mutex_);
+    ++stats_.clouds;
+    stats_.scans += frame.scans.size();
+    stats_.points.add(counts);
+    const double fraction = coverage.fraction();
+    stats_.coverage_sum += fraction;
+    stats_.min_coverage = std::min(stats_.min_coverage, fraction);
+    if (coverage.processed < coverage.total)
+      ++stats_.cut_short;
+    stats_.hit_bins += hit_bins;
   }
 
+  template <class T>
+  static void addValue(diagnostic_msgs::DiagnosticStatus& status, const std::string& key, const T& value)
+  {
+    diagnostic_msgs::KeyValue kv;
+    kv.key = key;
+    kv.value = boost::lexical_cast<std::string>(value);
+    status.values.push_back(kv);
+  }
 
-  double min_height_, max_height_, angle_min_, angle_max_, angle_increment_, scan_time_, range_min_, range_max_, range_min_sq_;
+  static void addLatency(diagnostic_msgs::DiagnosticStatus& status, const std::string& stage, const LatencyHistogram& histogram)
+  {
+    addValue(status, stage + " p50 [ms]", histogram.percentile(0.5) * 1e3);
+    addValue(status, stage + " p99 [ms]", histogram.percentile(0.99) * 1e3);
+    addValue(status, stage + " max [ms]", histogram.max() * 1e3);
+  }
+
+  void publishStatistics(const ros::TimerEvent&)
+  {
+    Statistics stats;
+    {
+      // same order as updateLoad()
+      boost::lock_guard<boost::mutex> load_lock(load_mutex_);
+      boost::lock_guard<boost::mutex> lock(stats_mutex_);
+      std::swap(stats, stats_);
+      // latest values, kept for periods without frames
+      stats_.load = stats.load;
+      stats_.load_stride = load_stride_;
+    }
+
+    diagnostic_msgs::DiagnosticArrayPtr msg(new diagnostic_msgs::DiagnosticArray());
+    msg->header.stamp = ros::Time::now();
+    msg->status.resize(LATENCY_STATS_BUILT ? 2 : 1);
+    diagnostic_msgs::DiagnosticStatus& status = msg->status[0];
+    status.name = getName();
+    if (stats.tf_dropped + stats.tf_expired + stats.mailbox_dropped + stats.pipeline_dropped > 0)
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Dropping clouds";
+    }
+    else if (stats.load_stride > 1)
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Shedding load";
+    }
+    else
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::OK;
+      status.message = "OK";
+    }
+
+    // everything counted since the previous message
+    addValue(status, "Clouds", stats.clouds);
+    addValue(status, "Points rejected for nan", stats.points.nan);
+    addValue(status, "Points rejected for height", stats.points.height);
+    addValue(status, "Points rejected for range_min", stats.points.range);
+    addValue(status, "Points rejected for angle", stats.points.angle);
+    addValue(status, "Points accepted", stats.points.accepted);
+    addValue(status, "Bins hit per scan", stats.scans > 0 ? (double)stats.hit_bins / stats.scans : 0.0);
+    addValue(status, "Mean cloud coverage", stats.clouds > 0 ? stats.coverage_sum / stats.clouds : 1.0);
+    addValue(status, "Min cloud coverage", stats.min_coverage);
+    addValue(status, "Clouds cut short by time_budget", stats.cut_short);
+    addValue(status, "Load", stats.load);
+    addValue(status, "Load stride", stats.load_stride);
+    addValue(status, "Load stride changes", stats.stride_changes);
+    addValue(status, "Clouds dropped waiting for tf", stats.tf_dropped);
+    addValue(status, "Clouds too old for tf", stats.tf_expired);
+    addValue(status, "Clouds replaced in the mailbox", stats.mailbox_dropped);
+    addValue(status, "Clouds dropped by the pipeline", stats.pipeline_dropped);
+
+    if (LATENCY_STATS_BUILT)
+    {
+      diagnostic_msgs::DiagnosticStatus& latency = msg->status[1];
+      latency.name = getName() + " latency";
+      latency.level = diagnostic_msgs::DiagnosticStatus::OK;
+      latency.message = "OK";
+      addValue(latency, "Samples", stats.latency.binning.count());
+      addLatency(latency, "Receive", stats.latency.receive);
+      addLatency(latency, "Waiting for tf", stats.latency.tf_wait);
+      addLatency(latency, "Transform lookup", stats.latency.lookup);
+      addLatency(latency, "Binning", stats.latency.binning);
+      addLatency(latency, "Publish", stats.latency.publish);
+      addLatency(latency, "Age", stats.latency.age);
+    }
+
+    stats_pub_.publish(msg);
+  }
+
+  /**
+   * Passes the messages of sub on to callback once tf can transform them into
+   * target_frame. With static_transform they go to callback right away: the
+   * transform is looked up at the latest time tf has, so there is nothing to
+   * wait for.
+   */
+  template <class M, class Callback>
+  void connectInput(message_filters::Subscriber<M>& sub, boost::scoped_ptr<tf::MessageFilter<M> >& filter,
+                    const std::string& target_frame, const Callback& callback)
+  {
+    if (static_transform_)
+    {
+      sub.registerCallback(boost::function<void(const boost::shared_ptr<M const>&)>(callback));
+      return;
+    }
+    filter.reset(new tf::MessageFilter<M>(sub, listener, target_frame, tf_queue_size_, nh_));
+    filter->registerCallback(boost::function<void(const boost::shared_ptr<M const>&)>(callback));
+    filter->registerFailureCallback(boost::bind(&CloudToScan::transformFailure, this, _2));
+  }
+
+  /**
+   * Counts clouds the tf message filter gave up on: clouds pushed out of the
+   * full queue and clouds older than the transforms still buffered. With
+   * static_transform, clouds that arrived before tf had the transform.
+   */
+  void transformFailure(tf::FilterFailureReason reason)
+  {
+    boost::lock_guard<boost::mutex> lock(stats_mutex_);
+    if (reason == tf::filter_failure_reasons::OutTheBack)
+    {
+      ++tf_expired_;
+      ++stats_.tf_expired;
+    }
+    else
+    {
+      ++tf_dropped_;
+      ++stats_.tf_dropped;
+    }
+    NODELET_WARN_THROTTLE(5.0, "Dropped %u clouds waiting for a transform into %s, %u of them too old to ever get one.",
+                          tf_dropped_ + tf_expired_, fusion_inputs_.empty() ? ref_frame_id_.c_str() : output_frame_id_.c_str(),
+                          tf_expired_);
+  }
+
+  /**
+   * Fills the frame with an empty scan per output for a cloud with the given
+   * header and points its scan_ranges at their ranges.
+   */
+  void makeScans(Frame& frame, const std_msgs::Header& header, const ScanConfig& config)
+  {
+    frame.scans.resize(outputs_.size());
+    frame.scan_ranges.resize(outputs_.size());
+    for (size_t i = 0; i < outputs_.size(); ++i)
+    {
+      frame.scans[i] = makeScan(header, config, outputs_[i].frame_id);
+      frame.scan_ranges[i] = &frame.scans[i]->ranges[0];
+    }
+  }
+
+  void publishScans(Frame& frame)
+  {
+    for (size_t i = 0; i < outputs_.size(); ++i)
+    {
+      outputs_[i].pub.publish(frame.scans[i]);
+      frame.scans[i].reset(); // so the pool sees it as free once subscribers are done
+    }
+  }
+
+  /**
+   * Returns an empty scan for a cloud with the given header. Scans come from
+   * the pool when one is free, their buffers are reused.
+   */
+  sensor_msgs::LaserScanPtr makeScan(const std_msgs::Header& header, const ScanConfig& config, const std::string& frame_id)
+  {
+    sensor_msgs::LaserScanPtr output;
+    {
+      boost::lock_guard<boost::mutex> lock(scan_pool_mutex_);
+      for (size_t i = 0; i < scan_pool_.size() && !output; ++i)
+      {
+        if (scan_pool_[i].unique())
+          output = scan_pool_[i];
+      }
+    }
+    if (!output)
+      output.reset(new sensor_msgs::LaserScan());
+
+    output->header.seq = header.seq;
+    output->header.stamp = header.stamp;
+    output->header.frame_id = frame_id; // Set output frame. Point clouds come from "optical" frame, scans come from corresponding mount frame
+    output->angle_min = config.angle_min;
+    output->angle_max = config.angle_max;
+    output->angle_increment = config.angle_increment;
+    output->time_increment = 0.0;
+    output->scan_time = config.scan_time;
+    output->range_min = config.range_min;
+    output->range_max = config.range_max;
+
+    output->ranges.assign(config.ranges_size, output->range_max + 1.0);
+    return output;
+  }
+
+  /**
+   * Transform of a cloud frame as last looked up and the state derived from
+   * it, reused while the lookups find it within transform_tolerance.
+   */
+  struct CloudTransform
+  {
+    CloudTransform(): valid(false), looked_up(0.0), matrix() {}
+    bool valid;
+    std::string frame_id;
+    double looked_up;           // monotonicTime() of the last lookup
+    tf::Transform lookup;       // from the cloud frame into the target frame
+    tf::Transform ref_to_out;   // virtual laser frame at zero height
+    tf::Transform cloud_to_out;
+    double matrix[12];          // cloud_to_out as the projection takes it
+  };
+
+  /** Everything binning a frame works on, so several frames can be binned at once. */
+  struct Frame
+  {
+    Frame(): started(0.0), done(false), abandoned(false), binned(false) {}
+
+    ScanProjector projector;
+    CloudTransform transform;
+    std::vector<tf::StampedTransform> laser_frames;
+    std::vector<sensor_msgs::LaserScanPtr> scans; // one per output
+    std::vector<float*> scan_ranges;
+    std::vector<BeamInterval> ring_intervals; // of unorganized lidar clouds, by ring
+
+    // filled by binFrame() for publishFrame()
+    boost::shared_ptr<const void> message;
+    ros::Time stamp;
+    double started; // monotonicTime() when binFrame() started, for the load
+    FrameTimes times;
+    PointCounts counts;
+    Coverage coverage;
+
+    // pipeline state, guarded by sequencer_mutex_
+    bool done, abandoned, binned;
+  };
+
+  /**
+   * Fills the cache with the transform from the cloud frame into target_frame
+   * at the cloud's stamp. With static_transform the transform at the latest
+   * time tf has is used, and looked up again only once static_transform_period
+   * passed since the cache was filled for the same frame. A looked up
+   * transform within transform_tolerance of the cached one leaves the cache as
+   * it is, so state derived from it stays valid. Sets changed if the cache
+   * was refilled.
+   */
+  bool cacheTransform(CloudTransform& cache, const std::string& target_frame, const std_msgs::Header& header, bool& changed)
+  {
+    changed = false;
+    const double now = monotonicTime();
+    const bool same_frame = cache.valid && cache.frame_id == header.frame_id;
+    if (same_frame && static_transform_ && now - cache.looked_up < static_transform_period_)
+      return true;
+
+    // the message filter made sure it is available, unless the transform is static
+    tf::StampedTransform transform;
+    try{
+      listener.lookupTransform(target_frame, header.frame_id, static_transform_ ? ros::Time(0) : header.stamp, transform);
+    }
+    catch (tf::TransformException ex){
+      if (static_transform_)
+      {
+        transformFailure(tf::filter_failure_reasons::Unknown);
+        return false;
+      }
+      ROS_ERROR("%s",ex.what());
+      return false;
+    }
+
+    cache.looked_up = now;
+    if (same_frame && withinTolerance(cache.lookup, transform, transform_tolerance_))
+      return true;
+
+    cache.valid = true;
+    cache.frame_id = header.frame_id;
+    cache.lookup = transform;
+    changed = true;
+    return true;
+  }
+
+  /** Compares in meters and radians. 0 requires an exact match, a negative tolerance never matches. */
+  static bool withinTolerance(const tf::Transform& a, const tf::Transform& b, double tolerance)
+  {
+    if (tolerance < 0.0)
+      return false;
+    if (tolerance == 0.0)
+      return a == b;
+    return a.getOrigin().distance(b.getOrigin()) <= tolerance &&
+           a.getRotation().angleShortestPath(b.getRotation()) <= tolerance;
+  }
+
+  /**
+   * Broadcasts the virtual laser frames for a cloud with the given header and
+   * updates the frame's transform from the cloud frame into the output frame
+   * at zero height. All bands share x, y and orientation, only
+   * their height differs.
+   */
+  bool lookupCloudTransform(Frame& frame, const std_msgs::Header& header, const ScanConfig& config)
+  {
+    CloudTransform& cloud_transform = frame.transform;
+    // transform from camera into reference frame
+    bool changed;
+    if (!cacheTransform(cloud_transform, ref_frame_id_, header, changed))
+      return false;
+
+    if (changed)
+    {
+      const tf::Transform& cloud_to_ref = cloud_transform.lookup;
+
+      // compute translation of virtual laser frame
+      // x,y come from camera frame
+      // z is zero here and between min/max height when broadcast
+      tf::Vector3 ref_origin = cloud_to_ref.getOrigin();
+      ref_origin.setZ( 0.0 );
+
+      // compute orientation of virtual laser frame
+      // rotation comes from the z axis of the optical camera frame
+      tf::Vector3 z_axis(0, 0, 1);
+      tf::Transform camera_rot(cloud_to_ref.getRotation());
+      tf::Vector3 rotated_z_axis = camera_rot * z_axis;
+      double alpha = atan2(rotated_z_axis.y(), rotated_z_axis.x());
+      tf::Quaternion ref_ori(tf::Vector3(0,0,1), alpha);
+
+      // transform from reference into 'virtual laser' output frame, and from cloud into output frame at zero height
+      tf::Transform& ref_to_out = cloud_transform.ref_to_out;
+      ref_to_out.setOrigin( ref_origin );
+      ref_to_out.setRotation( ref_ori );
+      cloud_transform.cloud_to_out.mult( ref_to_out.inverse(), cloud_to_ref );
+      toMatrix(cloud_transform.cloud_to_out, cloud_transform.matrix);
+    }
+
+    tf::Vector3 ref_origin = cloud_transform.ref_to_out.getOrigin();
+    frame.laser_frames.resize(outputs_.size());
+    for (size_t i = 0; i < outputs_.size(); ++i)
+    {
+      if (config.bands.empty())
+        ref_origin.setZ( (config.min_height+config.max_height)*0.5 );
+      else
+        ref_origin.setZ( (config.bands[i].min_height+config.bands[i].max_height)*0.5 );
+      tf::StampedTransform& ref_to_out = frame.laser_frames[i];
+      ref_to_out.frame_id_ = ref_frame_id_;
+      ref_to_out.child_frame_id_ = outputs_[i].frame_id;
+      ref_to_out.stamp_ = header.stamp;
+      ref_to_out.setRotation( cloud_transform.ref_to_out.getRotation() );
+      ref_to_out.setOrigin( ref_origin );
+    }
+    sendLaserFrames(frame.laser_frames);
+
+    return true;
+  }
+
+  /**
+   * Returns the lookup table for a width x height cloud, clearing it if the
+   * cloud size, the cloud to output transform or the configuration changed.
+   * Rays are learned lazily from the first valid point seen at each pixel.
+   */
+  PixelBin* updatePixelTable(const ScanConfig& config, const tf::Transform& cloud_to_out, uint32_t width, uint32_t height)
+  {
+    if (config.generation != pixel_table_generation_ || pixel_table_.empty() || width != pixel_table_width_ || height != pixel_table_height_ ||
+        !(cloud_to_out == pixel_table_xform_))
+    {
+      PixelBin unknown;
+      unknown.index = PixelBin::UNKNOWN;
+      pixel_table_.assign((size_t)width * height, unknown);
+      pixel_table_width_ = width;
+      pixel_table_height_ = height;
+      pixel_table_xform_ = cloud_to_out;
+      pixel_table_generation_ = config.generation;
+    }
+    return &pixel_table_[0];
+  }
+
+  /** Lookup table for an organized cloud, NULL if it is binned without one. */
+  PixelBin* cloudTable(const ScanConfig& config, const tf::Transform& cloud_to_out, uint32_t width, uint32_t height)
+  {
+    if (column_azimuth_ && height > 1 && height == ring_elevations_.size())
+      return updateRingTable(config, cloud_to_out, width, height);
+    if (use_pixel_table_ && height > 1)
+      return updatePixelTable(config, cloud_to_out, width, height);
+    return NULL;
+  }
+
+  /**
+   * Returns the lookup table for organized lidar clouds of width columns,
+   * rebuilding it if the cloud size, the cloud to output transform or the
+   * configuration changed. Pixel (col, row) is the beam of ring row at the
+   * azimuth of column col.
+   */
+  PixelBin* updateRingTable(const ScanConfig& config, const tf::Transform& cloud_to_out, uint32_t width, uint32_t height)
+  {
+    if (config.generation != pixel_table_generation_ || pixel_table_.empty() || width != pixel_table_width_ || height != pixel_table_height_ ||
+        !(cloud_to_out == pixel_table_xform_))
+    {
+      const double increment = column_azimuth_increment_ != 0.0 ? column_azimuth_increment_ : -2.0 * M_PI / width;
+      double transform[12];
+      toMatrix(cloud_to_out, transform);
+      pixel_table_.resize((size_t)width * height);
+      for (uint32_t row = 0; row < height; ++row)
+      {
+        const double elevation = ring_elevations_[row];
+        for (uint32_t col = 0; col < width; ++col)
+        {
+          const double azimuth = column_azimuth_start_ + col * increment;
+          setPixelRay(pixel_table_[row * width + col], config, transform,
+                      cos(elevation) * cos(azimuth), cos(elevation) * sin(azimuth), sin(elevation));
+        }
+      }
+      pixel_table_width_ = width;
+      pixel_table_height_ = height;
+      pixel_table_xform_ = cloud_to_out;
+      pixel_table_generation_ = config.generation;
+    }
+    return &pixel_table_[0];
+  }
+
+  /**
+   * Returns the lookup table for depth images with the given camera info,
+   * rebuilding it if the camera, the image size, the cloud to output
+   * transform or the configuration changed. Pixel (u, v) at depth d is the
+   * point d * ((u - cx) / fx, (v - cy) / fy, 1) in the optical frame.
+   */
+  const PixelBin* updateDepthTable(const ScanConfig& config, const tf::Transform& cloud_to_out, const sensor_msgs::CameraInfo& info)
+  {
+    const double fx = info.K[0], cx = info.K[2], fy = info.K[4], cy = info.K[5];
+    if (config.generation != pixel_table_generation_ || pixel_table_.empty() || info.width != pixel_table_width_ || info.height != pixel_table_height_ ||
+        !(cloud_to_out == pixel_table_xform_) || fx != pixel_table_camera_[0] || cx != pixel_table_camera_[1] ||
+        fy != pixel_table_camera_[2] || cy != pixel_table_camera_[3])
+    {
+      double transform[12];
+      toMatrix(cloud_to_out, transform);
+      pixel_table_.resize((size_t)info.width * info.height);
+      for (uint32_t v = 0; v < info.height; ++v)
+      {
+        for (uint32_t u = 0; u < info.width; ++u)
+          setPixelRay(pixel_table_[v * info.width + u], config, transform, (u - cx) / fx, (v - cy) / fy, 1.0);
+      }
+      pixel_table_width_ = info.width;
+      pixel_table_height_ = info.height;
+      pixel_table_xform_ = cloud_to_out;
+      pixel_table_generation_ = config.generation;
+      pixel_table_camera_[0] = fx;
+      pixel_table_camera_[1] = cx;
+      pixel_table_camera_[2] = fy;
+      pixel_table_camera_[3] = cy;
+    }
+    return &pixel_table_[0];
+  }
+
+  ScanConfigConstPtr config_; // only accessed through boost::atomic_load/atomic_store
   std::string output_frame_id_, ref_frame_id_;
+  bool raw_cloud_;
+  bool depth_image_;
+
+  int roi_x_offset_, roi_y_offset_, roi_width_, roi_height_;
+  int row_stride_, col_stride_;
+  bool auto_row_band_;
+  std::vector<double> ring_elevations_; // radians, by ring
+  bool column_azimuth_;
+  double column_azimuth_start_, column_azimuth_increment_; // radians, increment 0 for one clockwise revolution
+  double time_budget_;
+  size_t anytime_passes_;
+  int max_load_stride_;
+  double target_load_;
+  enum { LOAD_SETTLE_FRAMES = 10 };
+  static const double LOAD_SMOOTHING;
+  uint32_t load_stride_, frames_at_stride_;
+  uint32_t binning_threads_; // frames binned at once
+  double frame_time_; // smoothed, from binFrame() until published
+  boost::mutex load_mutex_;
+  ros::Time last_input_stamp_;
+  double input_period_; // smoothed
+  bool use_pixel_table_;
+  uint32_t pixel_table_generation_;
+  std::vector<PixelBin> pixel_table_;
+  uint32_t pixel_table_width_, pixel_table_height_;
+  tf::Transform pixel_table_xform_;
+  double pixel_table_camera_[4]; // fx, cx, fy, cy the depth table was built for
+
+  sensor_msgs::CameraInfo::ConstPtr camera_info_; // only accessed through boost::atomic_load/atomic_store
+
+  std::string kernel_name_;
+  FilterKernel kernel_;
 
   ros::NodeHandle nh_;
-  ros::Publisher pub_;
-  ros::Subscriber sub_;
+  // One output per height band
+  struct ScanOutput
+  {
+    ScanOutput(const std::string& topic, const std::string& frame_id): topic(topic), frame_id(frame_id) {}
+    std::string topic, frame_id;
+    ros::Publisher pub;
+  };
+  std::vector<ScanOutput> outputs_;
+  std::vector<HeightBand> bands_;
+  message_filters::Subscriber<PointCloud> cloud_sub_;
+  message_filters::Subscriber<sensor_msgs::PointCloud2> raw_sub_;
+  boost::scoped_ptr<tf::MessageFilter<PointCloud> > cloud_filter_;
+  boost::scoped_ptr<tf::MessageFilter<sensor_msgs::PointCloud2> > raw_filter_;
+  message_filters::Subscriber<sensor_msgs::Image> image_sub_;
+  boost::scoped_ptr<tf::MessageFilter<sensor_msgs::Image> > image_filter_;
+  ros::Subscriber info_sub_;
+  int tf_queue_size_;
+  double transform_tolerance_;
+  bool static_transform_;
+  double static_transform_period_;
+  double frame_period_, frame_threshold_;
+  ros::Timer frame_timer_;
+  boost::mutex frame_mutex_;
+  std::vector<tf::StampedTransform> broadcast_frames_; // what the timer broadcasts
+  double stats_rate_;
+  ros::Publisher stats_pub_;
+  ros::Timer stats_timer_;
+  boost::mutex stats_mutex_;
+  Statistics stats_;
+  uint32_t tf_dropped_, tf_expired_; // totals for the warnings
+  enum { ARRIVAL_RING_SIZE = 64 };
+  Arrival arrivals_[ARRIVAL_RING_SIZE];
+  size_t arrival_next_;
+  boost::mutex arrival_mutex_;
+
+  bool latest_only_;
+  boost::scoped_ptr<boost::thread> mailbox_thread_;
+  boost::mutex mailbox_mutex_;
+  boost::condition_variable mailbox_cond_;
+  PointCloud::ConstPtr mailbox_cloud_;
+  sensor_msgs::PointCloud2::ConstPtr mailbox_raw_cloud_;
+  sensor_msgs::Image::ConstPtr mailbox_image_;
+  bool mailbox_shutdown_;
+  uint32_t mailbox_dropped_;
+
+  // One input of fusion mode
+  struct FusionInput
+  {
+    FusionInput(const std::string& topic): topic(topic), projected(false) {}
+    std::string topic;
+    message_filters::Subscriber<sensor_msgs::PointCloud2> sub;
+    boost::scoped_ptr<tf::MessageFilter<sensor_msgs::PointCloud2> > filter;
+    sensor_msgs::PointCloud2::ConstPtr cloud; // waiting in the current sync window
+    CloudTransform transform;
+    ScanProjector projector;
+    std::vector<float> ranges;               // private ranges of all scans
+    std::vector<float*> scan_ranges;
+    PointCounts counts;
+    bool projected;
+  };
+  std::vector<boost::shared_ptr<FusionInput> > fusion_inputs_;
+  boost::scoped_ptr<WorkerPool> fusion_pool_;
+  WorkerPool::LoopBody project_input_;
+  boost::mutex fusion_mutex_;
+  ros::Duration fusion_window_;
+  ros::Time fusion_window_start_;
+  ros::Time fusion_published_stamp_; // stamp of the last fused scans
+  size_t fusion_pending_;
+  const ScanConfig* fusion_config_; // config of the window being projected
+
+  Frame frame_; // used when processing one frame at a time
+
+  std::vector<boost::shared_ptr<Frame> > pipeline_frames_;
+  boost::scoped_ptr<WorkerPool> frame_pool_;
+  double max_frame_lag_;
+  boost::mutex sequencer_mutex_;
+  std::vector<Frame*> free_frames_;
+  std::deque<Frame*> in_flight_; // in dispatch order
+  std::deque<Frame*> ready_frames_; // to be published, in order
+  bool publishing_; // a thread is publishing ready_frames_
+  ros::Time last_published_stamp_;
+  uint32_t pipeline_dropped_;
+
+  boost::mutex scan_pool_mutex_;
+  std::vector<sensor_msgs::LaserScanPtr> scan_pool_;
+  enum { ALLOCATION_WARMUP_FRAMES = 10 };
+  boost::mutex allocation_check_mutex_;
+  uint32_t allocation_check_generation_;
+  int allocation_check_frames_;
 
 };
 
+const double CloudToScan::LOAD_SMOOTHING = 0.1;
+
 PLUGINLIB_DECLARE_CLASS(pointcloud_to_laserscan, CloudToScan, pointcloud_to_laserscan::CloudToScan, nodelet::Nodelet);
 }
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef POINTCLOUD_TO_LASERSCAN_LATENCY_HISTOGRAM_H
+#define POINTCLOUD_TO_LASERSCAN_LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+namespace pointcloud_to_laserscan
+{
+
+/** Seconds on the monotonic clock. */
+inline double monotonicTime()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Latency histogram with fixed buckets: four per octave, evenly spaced
+ * within it, from 1 us up to about 17 minutes. Percentiles are reported as
+ * the upper bound of the bucket they fall into, i.e. up to 25% high (just
+ * above a power of two, where the buckets are widest relative to the value).
+ */
+class LatencyHistogram
+{
+public:
+  LatencyHistogram()
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    memset(buckets_, 0, sizeof(buckets_));
+    count_ = 0;
+    max_ = 0.0;
+  }
+
+  void record(double seconds)
+  {
+    ++buckets_[bucket(seconds)];
+    ++count_;
+    if (seconds > max_)
+      max_ = seconds;
+  }
+
+  uint64_t count() const { return count_; }
+  double max() const { return max_; }
+
+  /** Returns the latency below which a fraction p of the samples fall. */
+  double percentile(double p) const
+  {
+    if (count_ == 0)
+      return 0.0;
+    uint64_t rank = (uint64_t)ceil(p * count_);
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+    {
+      seen += buckets_[i];
+      if (seen >= rank && seen > 0)
+        return std::min(upperBound(i), max_);
+    }
+    return max_;
+  }
+
+private:
+  enum { BUCKETS_PER_OCTAVE = 4, NUM_OCTAVES = 30, NUM_BUCKETS = BUCKETS_PER_OCTAVE * NUM_OCTAVES };
+
+  static int bucket(double seconds)
+  {
+    double us = seconds * 1e6;
+    if (!(us > 1.0))
+      return 0;
+    int exponent;
+    double mantissa = frexp(us, &exponent); // us = mantissa * 2^exponent, mantissa in [0.5, 1)
+    int i = (exponent - 1) * BUCKETS_PER_OCTAVE + (int)((mantissa * 2.0 - 1.0) * BUCKETS_PER_OCTAVE);
+    return i < NUM_BUCKETS ? i : NUM_BUCKETS - 1;
+  }
+
+  static double upperBound(int i)
+  {
+    return ldexp(1.0 + (double)(i % BUCKETS_PER_OCTAVE + 1) / BUCKETS_PER_OCTAVE, i / BUCKETS_PER_OCTAVE) * 1e-6;
+  }
+
+  uint64_t buckets_[NUM_BUCKETS];
+  uint64_t count_;
+  double max_;
+};
+
+} // namespace pointcloud_to_laserscan
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "scan_kernels.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(HAVE_AVX2_KERNEL)
+// the AVX2 kernel hands its tail to the SSE one
+#error "HAVE_AVX2_KERNEL needs SSE2 in this translation unit"
+#endif
+
+namespace pointcloud_to_laserscan
+{
+
+namespace
+{
+
+/*
+ * The kernels are templates on the point layout: PointStep is the point step
+ * in bytes, or 0 if it is only known at runtime, and Dense drops the nan
+ * checks.
+ */
+
+struct ScalarKernel
+{
+  template <size_t PointStep, bool Dense>
+  static size_t filter(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                       float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts);
+};
+
+template <size_t PointStep, bool Dense>
+size_t ScalarKernel::filter(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                            float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts)
+{
+  const size_t step = PointStep ? PointStep : point_step;
+  const float* m = params.transform;
+  size_t n = 0;
+  for (size_t i = 0; i < count; ++i, data += step)
+  {
+    float p[3];
+    memcpy(p, data, sizeof(p));
+
+    const float z = m[8] * p[0] + m[9] * p[1] + m[10] * p[2] + m[11];
+    if (!(z >= params.min_height && z <= params.max_height))
+    {
+      if (!Dense && z != z)
+        ++counts.nan;
+      else
+        ++counts.height;
+      continue;
+    }
+
+    const float x = m[0] * p[0] + m[1] * p[1] + m[2] * p[2] + m[3];
+    const float y = m[4] * p[0] + m[5] * p[1] + m[6] * p[2] + m[7];
+    const float r2 = x * x + y * y;
+    if (!(r2 >= params.range_min_sq))
+    {
+      if (!Dense && r2 != r2)
+        ++counts.nan;
+      else
+        ++counts.range;
+      continue;
+    }
+
+    xs[n] = x;
+    ys[n] = y;
+    zs[n] = z;
+    range_sq[n] = r2;
+    ++n;
+  }
+  return n;
+}
+
+#if defined(__SSE2__)
+// Set bits of a 4 lane movemask. Without -mpopcnt __builtin_popcount is a
+// library call, which cost as much as the vector code saved.
+const int LANE_COUNT[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+struct SSEKernel
+{
+  template <size_t PointStep, bool Dense>
+  static size_t filter(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                       float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts);
+};
+
+template <size_t PointStep, bool Dense>
+size_t SSEKernel::filter(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                         float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts)
+{
+  const size_t step = PointStep ? PointStep : point_step;
+  const float* m = params.transform;
+  const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]), m3 = _mm_set1_ps(m[3]);
+  const __m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m6 = _mm_set1_ps(m[6]), m7 = _mm_set1_ps(m[7]);
+  const __m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m10 = _mm_set1_ps(m[10]), m11 = _mm_set1_ps(m[11]);
+  const __m128 min_height = _mm_set1_ps(params.min_height);
+  const __m128 max_height = _mm_set1_ps(params.max_height);
+  const __m128 range_min_sq = _mm_set1_ps(params.range_min_sq);
+
+  // Every point is read as four floats, which may reach into the next point
+  // even if the step is 16 bytes or more: x need not be at the start of the
+  // point, and strided views skip points. The last one is left to the scalar
+  // loop so we never read past the buffer.
+  const size_t vector_count = count > 0 ? count - 1 : 0;
+
+  size_t n = 0, i = 0;
+  for (; i + 4 <= vector_count; i += 4, data += 4 * step)
+  {
+    __m128 px = _mm_loadu_ps(reinterpret_cast<const float*>(data));
+    __m128 py = _mm_loadu_ps(reinterpret_cast<const float*>(data + step));
+    __m128 pz = _mm_loadu_ps(reinterpret_cast<const float*>(data + 2 * step));
+    __m128 pw = _mm_loadu_ps(reinterpret_cast<const float*>(data + 3 * step));
+    _MM_TRANSPOSE4_PS(px, py, pz, pw);
+
+    // height slab first, most points of a depth cloud fail it
+    const __m128 z = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m8, px), _mm_mul_ps(m9, py)), _mm_mul_ps(m10, pz)), m11);
+    const __m128 mask = _mm_and_ps(_mm_cmpge_ps(z, min_height), _mm_cmple_ps(z, max_height));
+    const int height_bits = _mm_movemask_ps(mask);
+    const int z_nan_bits = Dense ? 0 : _mm_movemask_ps(_mm_cmpunord_ps(z, z));
+    counts.nan += LANE_COUNT[z_nan_bits];
+    counts.height += 4 - LANE_COUNT[height_bits | z_nan_bits];
+    if (height_bits == 0)
+      continue;
+
+    const __m128 x = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, px), _mm_mul_ps(m1, py)), _mm_mul_ps(m2, pz)), m3);
+    const __m128 y = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m4, px), _mm_mul_ps(m5, py)), _mm_mul_ps(m6, pz)), m7);
+    const __m128 r2 = _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y));
+    const int range_bits = _mm_movemask_ps(_mm_cmpge_ps(r2, range_min_sq));
+    const int r2_nan_bits = Dense ? 0 : _mm_movemask_ps(_mm_cmpunord_ps(r2, r2));
+    counts.nan += LANE_COUNT[height_bits & r2_nan_bits];
+    counts.range += LANE_COUNT[height_bits & ~(range_bits | r2_nan_bits) & 0xf];
+
+    const int bits = height_bits & range_bits;
+    if (bits == 0)
+      continue;
+
+    // Every lane is written and only the survivors advance n, which beats a
+    // branch per lane on the mixed masks of a real cloud. n never passes
+    // the point being written, so the outputs stay within count entries.
+    float lane_x[4], lane_y[4], lane_z[4], lane_r2[4];
+    _mm_storeu_ps(lane_x, x);
+    _mm_storeu_ps(lane_y, y);
+    _mm_storeu_ps(lane_z, z);
+    _mm_storeu_ps(lane_r2, r2);
+    for (int lane = 0; lane < 4; ++lane)
+    {
+      xs[n] = lane_x[lane];
+      ys[n] = lane_y[lane];
+      zs[n] = lane_z[lane];
+      range_sq[n] = lane_r2[lane];
+      n += (bits >> lane) & 1;
+    }
+  }
+
+  return n + ScalarKernel::filter<PointStep, Dense>(data, step, count - i, params, xs + n, ys + n, zs + n,
+                                                    range_sq + n, counts);
+}
+#endif
+
+/** The version of Kernel for point_step and dense. */
+template <class Kernel>
+FilterKernel specialize(size_t point_step, bool dense)
+{
+  switch (point_step)
+  {
+    case 16:
+      return dense ? &Kernel::template filter<16, true> : &Kernel::template filter<16, false>;
+    case 32:
+      return dense ? &Kernel::template filter<32, true> : &Kernel::template filter<32, false>;
+    case 48:
+      return dense ? &Kernel::template filter<48, true> : &Kernel::template filter<48, false>;
+    default:
+      return dense ? &Kernel::template filter<0, true> : &Kernel::template filter<0, false>;
+  }
+}
+
+} // namespace
+
+size_t filterPointsScalar(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                          float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts)
+{
+  return ScalarKernel::filter<0, false>(data, point_step, count, params, xs, ys, zs, range_sq, counts);
+}
+
+#if defined(__SSE2__)
+size_t filterPointsSSE(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                       float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts)
+{
+  return SSEKernel::filter<0, false>(data, point_step, count, params, xs, ys, zs, range_sq, counts);
+}
+#endif
+
+FilterKernel specializeFilterKernel(FilterKernel kernel, size_t point_step, bool dense)
+{
+#if defined(HAVE_AVX2_KERNEL)
+  if (kernel == &filterPointsAVX2)
+    return specializeFilterKernelAVX2(point_step, dense);
+#endif
+#if defined(__SSE2__)
+  if (kernel == &filterPointsSSE)
+    return specialize<SSEKernel>(point_step, dense);
+#endif
+  if (kernel == &filterPointsScalar)
+    return specialize<ScalarKernel>(point_step, dense);
+  return kernel;
+}
+
+FilterKernel selectFilterKernel(const std::string& name, std::string* selected)
+{
+  FilterKernel kernel = &filterPointsScalar;
+  std::string kernel_name = "scalar";
+
+#if defined(HAVE_AVX2_KERNEL)
+  if ((name == "auto" || name == "avx2") && __builtin_cpu_supports("avx2"))
+  {
+    kernel = &filterPointsAVX2;
+    kernel_name = "avx2";
+  }
+  else
+#endif
+#if defined(__SSE2__)
+  if (name == "auto" || name == "sse" || name == "avx2")
+  {
+    kernel = &filterPointsSSE;
+    kernel_name = "sse";
+  }
+#endif
+
+  if (selected)
+    *selected = kernel_name;
+  return kernel;
+}
+
+} // namespace pointcloud_to_laserscan
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef POINTCLOUD_TO_LASERSCAN_SCAN_KERNELS_H
+#define POINTCLOUD_TO_LASERSCAN_SCAN_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace pointcloud_to_laserscan
+{
+
+/**
+ * Parameters of the point filter kernels. All values are in the output frame.
+ */
+struct FilterParams
+{
+  float transform[12];  // row-major 3x4 transform from the cloud into the output frame
+  float min_height, max_height;
+  float range_min_sq;
+};
+
+/**
+ * Number of points rejected by each filter stage and accepted into the scan.
+ */
+struct PointCounts
+{
+  PointCounts(): nan(0), height(0), range(0), angle(0), accepted(0) {}
+
+  void add(const PointCounts& other)
+  {
+    nan += other.nan;
+    height += other.height;
+    range += other.range;
+    angle += other.angle;
+    accepted += other.accepted;
+  }
+
+  uint64_t nan, height, range, angle, accepted;
+};
+
+/**
+ * Transforms count points into the output frame and keeps the ones inside
+ * [min_height, max_height] that are at least range_min away. Points with a
+ * nan coordinate never pass. Each point consists of three consecutive floats
+ * x, y, z starting at data + i * point_step, so point_step must be at least
+ * 12 bytes. The x/y/z coordinates and the squared range of the surviving
+ * points are written to xs, ys, zs and range_sq, which must hold count
+ * entries each. Returns the number of survivors; the entries after them may
+ * be overwritten with scratch values.
+ *
+ * The nan, height and range rejections are added to counts. A point failing
+ * the height test counts as nan if its z is nan, a point failing the range
+ * test if its x or y is nan.
+ */
+typedef size_t (*FilterKernel)(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                               float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts);
+
+size_t filterPointsScalar(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                          float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts);
+
+#if defined(__SSE2__)
+size_t filterPointsSSE(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                       float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts);
+#endif
+
+#if defined(HAVE_AVX2_KERNEL)
+size_t filterPointsAVX2(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                        float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts);
+
+/** The AVX2 kernel for point_step and dense, see specializeFilterKernel(). */
+FilterKernel specializeFilterKernelAVX2(size_t point_step, bool dense);
+#endif
+
+/**
+ * Returns a version of kernel, one of the kernels above, compiled for clouds
+ * with the given point_step and, if dense, without nan points. Steps of 16
+ * (pcl::PointXYZ), 32 (PointXYZI, PointXYZRGB, most lidar drivers) and 48
+ * bytes (PointXYZRGBNormal, Ouster) are compile-time constants in their
+ * versions, other steps get a generic one. Dense versions skip the nan
+ * checks: a nan point still never passes, but counts as a height or range
+ * rejection. Unknown kernels are returned as they are.
+ */
+FilterKernel specializeFilterKernel(FilterKernel kernel, size_t point_step, bool dense);
+
+/**
+ * Returns the filter kernel called name ("scalar", "sse" or "avx2"), or the
+ * fastest one the CPU supports if name is "auto". Falls back to the scalar
+ * kernel for unknown or unsupported names. The name of the selected kernel
+ * is stored in selected if it is not NULL.
+ */
+FilterKernel selectFilterKernel(const std::string& name, std::string* selected = NULL);
+
+} // namespace pointcloud_to_laserscan
+
+#endif
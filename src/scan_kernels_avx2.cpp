@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Compiled with -mavx2. Only called after selectFilterKernel() checked that
+// the CPU supports AVX2.
+
+#include "scan_kernels.h"
+#include <immintrin.h>
+
+namespace pointcloud_to_laserscan
+{
+
+namespace
+{
+
+// Loads points i and i + 4 into the lower and upper halves of a register.
+inline __m256 loadPointPair(const uint8_t* data, size_t point_step, size_t i)
+{
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(reinterpret_cast<const float*>(data + i * point_step))),
+                              _mm_loadu_ps(reinterpret_cast<const float*>(data + (i + 4) * point_step)), 1);
+}
+
+// see ScalarKernel in scan_kernels.cpp
+template <size_t PointStep, bool Dense>
+size_t filterPoints(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                    float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts)
+{
+  const size_t step = PointStep ? PointStep : point_step;
+  const float* m = params.transform;
+  const __m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]), m2 = _mm256_set1_ps(m[2]), m3 = _mm256_set1_ps(m[3]);
+  const __m256 m4 = _mm256_set1_ps(m[4]), m5 = _mm256_set1_ps(m[5]), m6 = _mm256_set1_ps(m[6]), m7 = _mm256_set1_ps(m[7]);
+  const __m256 m8 = _mm256_set1_ps(m[8]), m9 = _mm256_set1_ps(m[9]), m10 = _mm256_set1_ps(m[10]), m11 = _mm256_set1_ps(m[11]);
+  const __m256 min_height = _mm256_set1_ps(params.min_height);
+  const __m256 max_height = _mm256_set1_ps(params.max_height);
+  const __m256 range_min_sq = _mm256_set1_ps(params.range_min_sq);
+
+  // see SSEKernel in scan_kernels.cpp
+  const size_t vector_count = count > 0 ? count - 1 : 0;
+
+  size_t n = 0, i = 0;
+  for (; i + 8 <= vector_count; i += 8, data += 8 * step)
+  {
+    // Two 4x4 transposes side by side: lanes 0-3 hold points 0-3, lanes 4-7 points 4-7.
+    const __m256 r0 = loadPointPair(data, step, 0);
+    const __m256 r1 = loadPointPair(data, step, 1);
+    const __m256 r2 = loadPointPair(data, step, 2);
+    const __m256 r3 = loadPointPair(data, step, 3);
+    const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+    const __m256 t1 = _mm256_unpacklo_ps(r2, r3);
+    const __m256 t2 = _mm256_unpackhi_ps(r0, r1);
+    const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+    const __m256 px = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 py = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 pz = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+
+    const __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m8, px), _mm256_mul_ps(m9, py)),
+                                                 _mm256_mul_ps(m10, pz)), m11);
+    const __m256 mask = _mm256_and_ps(_mm256_cmp_ps(z, min_height, _CMP_GE_OQ), _mm256_cmp_ps(z, max_height, _CMP_LE_OQ));
+    const int height_bits = _mm256_movemask_ps(mask);
+    const int z_nan_bits = Dense ? 0 : _mm256_movemask_ps(_mm256_cmp_ps(z, z, _CMP_UNORD_Q));
+    counts.nan += __builtin_popcount(z_nan_bits);
+    counts.height += 8 - __builtin_popcount(height_bits | z_nan_bits);
+    if (height_bits == 0)
+      continue;
+
+    const __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, px), _mm256_mul_ps(m1, py)),
+                                                 _mm256_mul_ps(m2, pz)), m3);
+    const __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m4, px), _mm256_mul_ps(m5, py)),
+                                                 _mm256_mul_ps(m6, pz)), m7);
+    const __m256 rsq = _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y));
+    const int range_bits = _mm256_movemask_ps(_mm256_cmp_ps(rsq, range_min_sq, _CMP_GE_OQ));
+    const int r2_nan_bits = Dense ? 0 : _mm256_movemask_ps(_mm256_cmp_ps(rsq, rsq, _CMP_UNORD_Q));
+    counts.nan += __builtin_popcount(height_bits & r2_nan_bits);
+    counts.range += __builtin_popcount(height_bits & ~(range_bits | r2_nan_bits));
+
+    int bits = height_bits & range_bits;
+    if (bits == 0)
+      continue;
+
+    float lane_x[8], lane_y[8], lane_z[8], lane_r2[8];
+    _mm256_storeu_ps(lane_x, x);
+    _mm256_storeu_ps(lane_y, y);
+    _mm256_storeu_ps(lane_z, z);
+    _mm256_storeu_ps(lane_r2, rsq);
+    for (int lane = 0; bits != 0; ++lane, bits >>= 1)
+    {
+      if (bits & 1)
+      {
+        xs[n] = lane_x[lane];
+        ys[n] = lane_y[lane];
+        zs[n] = lane_z[lane];
+        range_sq[n] = lane_r2[lane];
+        ++n;
+      }
+    }
+  }
+
+  // the SSE kernel is built without -mavx2, so its versions live in scan_kernels.cpp
+  FilterKernel tail = specializeFilterKernel(&filterPointsSSE, step, Dense);
+  return n + tail(data, step, count - i, params, xs + n, ys + n, zs + n, range_sq + n, counts);
+}
+
+} // namespace
+
+size_t filterPointsAVX2(const uint8_t* data, size_t point_step, size_t count, const FilterParams& params,
+                        float* xs, float* ys, float* zs, float* range_sq, PointCounts& counts)
+{
+  return filterPoints<0, false>(data, point_step, count, params, xs, ys, zs, range_sq, counts);
+}
+
+FilterKernel specializeFilterKernelAVX2(size_t point_step, bool dense)
+{
+  switch (point_step)
+  {
+    case 16:
+      return dense ? &filterPoints<16, true> : &filterPoints<16, false>;
+    case 32:
+      return dense ? &filterPoints<32, true> : &filterPoints<32, false>;
+    case 48:
+      return dense ? &filterPoints<48, true> : &filterPoints<48, false>;
+    default:
+      return dense ? &filterPoints<0, true> : &filterPoints<0, false>;
+  }
+}
+
+} // namespace pointcloud_to_laserscan
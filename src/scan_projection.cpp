@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "scan_projection.h"
+#include "allocation_counter.h"
+#include <limits>
+#include <boost/bind.hpp>
+
+namespace pointcloud_to_laserscan
+{
+
+const double ProjectionConfig::EDGE_GUARD = 1e-9;
+
+ProjectionConfig::ProjectionConfig(): min_height(0.10),
+                                      max_height(0.15),
+                                      angle_min(-M_PI/2),
+                                      angle_max(M_PI/2),
+                                      angle_increment(M_PI/180.0/2.0),
+                                      range_min(0.45),
+                                      num_threads(1)
+{
+  update();
+}
+
+void ProjectionConfig::update()
+{
+  range_min_sq = range_min * range_min;
+  slab_min_height = min_height;
+  slab_max_height = max_height;
+  for (size_t i = 0; i < bands.size(); ++i)
+  {
+    if (i == 0 || bands[i].min_height < slab_min_height)
+      slab_min_height = bands[i].min_height;
+    if (i == 0 || bands[i].max_height > slab_max_height)
+      slab_max_height = bands[i].max_height;
+  }
+  // computed from the float values stored in the scan, like the bin indices
+  ranges_size = std::ceil(((float)angle_max - (float)angle_min) / (float)angle_increment);
+  updateBinEdges();
+}
+
+int32_t ProjectionConfig::exactBinIndex(float x, float y) const
+{
+  // Computed in double: with float arguments atan2 may resolve to the float
+  // overload, which is not exact enough for the guard band.
+  double angle = -atan2(-(double)y, (double)x);
+  if (angle < (float)angle_min || angle > (float)angle_max)
+  {
+    POINT_DEBUG("rejected for angle %f not in range (%f, %f)\n", angle, angle_min, angle_max);
+    return OUTSIDE;
+  }
+  size_t index = (angle - (float)angle_min) / (float)angle_increment;
+  if (index >= ranges_size)
+    return OUTSIDE; // exactly at angle_max
+  return index;
+}
+
+static double edgePseudoAngle(double angle)
+{
+  if (angle <= -M_PI)
+    return -std::numeric_limits<double>::infinity();
+  if (angle > M_PI)
+    return std::numeric_limits<double>::infinity();
+  return pseudoAngle(cos(angle), sin(angle));
+}
+
+void ProjectionConfig::updateBinEdges()
+{
+  const double amin = (float)angle_min, inc = (float)angle_increment;
+  bin_edges.resize(ranges_size + 2);
+  for (uint32_t i = 0; i <= ranges_size; ++i)
+    bin_edges[i] = edgePseudoAngle(amin + i * inc);
+  bin_edges[ranges_size + 1] = std::numeric_limits<double>::infinity();
+  max_edge = edgePseudoAngle((float)angle_max);
+
+  edge_cells.resize(4 * (ranges_size + 1));
+  edge_cell_scale = edge_cells.size() / 4.0;
+  uint32_t edges = 0;
+  for (size_t i = 0; i < edge_cells.size(); ++i)
+  {
+    const double cell_start = i / edge_cell_scale - 2.0;
+    while (bin_edges[edges] <= cell_start)
+      ++edges;
+    edge_cells[i] = edges;
+  }
+}
+
+ScanProjector::ScanProjector(): kernel_(&filterPointsScalar), shared_pool_(NULL)
+{
+  // bound once, building a loop body per cloud would allocate
+  project_chunk_ = boost::bind(&ScanProjector::projectChunk, this, _1);
+}
+
+void ScanProjector::project(const CloudView& view, const double* transform, const ProjectionConfig& config,
+                            float* const* ranges, PointCounts& counts)
+{
+  FilterParams params;
+  std::copy(transform, transform + 12, params.transform);
+  params.min_height = config.slab_min_height;
+  params.max_height = config.slab_max_height;
+  params.range_min_sq = config.range_min_sq;
+  const FilterKernel kernel = specializeFilterKernel(kernel_, view.point_step, view.dense);
+
+  size_t num_points = (size_t)view.width * view.height;
+  size_t num_threads = std::max(1, config.num_threads);
+  size_t num_chunks = std::max((size_t)1, std::min(num_threads, num_points / MIN_POINTS_PER_THREAD));
+
+  if (partials_.size() < num_chunks)
+    partials_.resize(num_chunks);
+  for (size_t i = 0; i < num_chunks; ++i)
+  {
+    partials_[i].xs.resize(BATCH_SIZE);
+    partials_[i].ys.resize(BATCH_SIZE);
+    partials_[i].zs.resize(BATCH_SIZE);
+    partials_[i].range_sq.resize(BATCH_SIZE);
+  }
+
+  if (num_chunks == 1)
+  {
+    filterAndBin(view, 0, num_points, params, kernel, config, partials_[0], ranges, counts);
+    return;
+  }
+
+  WorkerPool* pool = shared_pool_;
+  if (!pool)
+  {
+    if (!pool_ || pool_->size() != num_threads - 1)
+      pool_.reset(new WorkerPool(num_threads - 1));
+    pool = pool_.get();
+  }
+
+  const size_t num_scans = config.numScans();
+  for (size_t i = 0; i < num_chunks; ++i)
+  {
+    Partial& partial = partials_[i];
+    if (i > 0)
+    {
+      partial.ranges.assign(num_scans * config.ranges_size, std::numeric_limits<float>::infinity());
+      partial.scan_ranges.resize(num_scans);
+      for (size_t j = 0; j < num_scans; ++j)
+        partial.scan_ranges[j] = &partial.ranges[j * config.ranges_size];
+    }
+    partial.counts = PointCounts();
+  }
+
+  job_.view = &view;
+  job_.params = &params;
+  job_.kernel = kernel;
+  job_.config = &config;
+  job_.ranges = ranges;
+  job_.num_points = num_points;
+  job_.num_chunks = num_chunks;
+  pool->parallelFor(num_chunks, project_chunk_);
+
+  for (size_t i = 0; i < num_chunks; ++i)
+  {
+    counts.add(partials_[i].counts);
+    if (i > 0)
+      mergeRanges(ranges, &partials_[i].scan_ranges[0], config);
+  }
+}
+
+void mergeRanges(float* const* ranges, const float* const* other, const ProjectionConfig& config)
+{
+  for (size_t i = 0; i < config.numScans(); ++i)
+  {
+    float* scan = ranges[i];
+    const float* other_scan = other[i];
+    for (size_t j = 0; j < config.ranges_size; ++j)
+      scan[j] = std::min(scan[j], other_scan[j]);
+  }
+}
+
+size_t regionSize(const PixelRegion& region)
+{
+  if (region.empty())
+    return 0;
+  return (size_t)((region.col_end - region.col_begin + region.col_stride - 1) / region.col_stride) *
+         ((region.row_end - region.row_begin + region.row_stride - 1) / region.row_stride);
+}
+
+CloudView regionView(const CloudView& view, const PixelRegion& region)
+{
+  CloudView sub = view;
+  sub.data = view.data + region.row_begin * view.row_step + region.col_begin * view.point_step;
+  sub.point_step = view.point_step * region.col_stride;
+  sub.row_step = view.row_step * region.row_stride;
+  if (region.empty())
+  {
+    sub.width = sub.height = 0;
+    return sub;
+  }
+  sub.width = (region.col_end - region.col_begin + region.col_stride - 1) / region.col_stride;
+  sub.height = (region.row_end - region.row_begin + region.row_stride - 1) / region.row_stride;
+  return sub;
+}
+
+PixelRegion interleavedRegion(const PixelRegion& region, size_t pass, size_t passes)
+{
+  size_t offset = 0;
+  for (size_t bit = 1; bit < passes; bit <<= 1)
+  {
+    offset <<= 1;
+    if (pass & bit)
+      offset |= 1;
+  }
+
+  PixelRegion sub = region;
+  sub.col_begin = std::min((size_t)region.col_end, region.col_begin + offset * region.col_stride);
+  sub.col_stride = region.col_stride * passes;
+  return sub;
+}
+
+/** Shrinks the rows of region to [first, last], keeping them on its stride. */
+static void limitRows(PixelRegion& region, uint32_t first, uint32_t last)
+{
+  if (first > last)
+  {
+    region.row_end = region.row_begin;
+    return;
+  }
+  // keep the rows on the stride of the full region
+  region.row_begin += (first - region.row_begin) / region.row_stride * region.row_stride;
+  region.row_end = last + 1;
+}
+
+void limitRowsToSlab(PixelRegion& region, const CameraIntrinsics& camera, const double* transform,
+                     const ProjectionConfig& config, double range_max)
+{
+  if (region.empty())
+    return;
+
+  // Height of the point at depth d along the ray of pixel (u, v) is
+  // tz + d * (r0 * (u - cx) / fx + r1 * (v - cy) / fy + r2), linear in u. A
+  // point in range is at most max_depth from the camera, and depth is at most
+  // that distance.
+  const double r0 = transform[8], r1 = transform[9], r2 = transform[10], tz = transform[11];
+  const double margin = 1e-3; // heights of the points are computed in float
+  const double min_height = config.slab_min_height - margin, max_height = config.slab_max_height + margin;
+  const double dz = std::max(fabs(min_height - tz), fabs(max_height - tz));
+  const double horizontal = range_max + hypot(transform[3], transform[7]);
+  const double max_depth = sqrt(horizontal * horizontal + dz * dz);
+  const double u0 = r0 * (region.col_begin - camera.cx) / camera.fx;
+  const double u1 = r0 * (region.col_end - 1 - camera.cx) / camera.fx;
+
+  uint32_t first = region.row_end, last = region.row_begin;
+  for (uint32_t v = region.row_begin; v < region.row_end; ++v)
+  {
+    const double slope_v = r1 * (v - camera.cy) / camera.fy + r2;
+    const double slope_min = std::min(0.0, std::min(u0, u1) + slope_v);
+    const double slope_max = std::max(0.0, std::max(u0, u1) + slope_v);
+    if (tz + max_depth * slope_max >= min_height && tz + max_depth * slope_min <= max_height)
+    {
+      first = std::min(first, v);
+      last = v;
+    }
+  }
+  limitRows(region, first, last);
+}
+
+/** Limits [min_dist, max_dist] to the distances d with a + d * b >= 0. */
+static void keepNonNegative(double a, double b, double& min_dist, double& max_dist)
+{
+  if (b > 0.0)
+    min_dist = std::max(min_dist, -a / b);
+  else if (b < 0.0)
+    max_dist = std::min(max_dist, -a / b);
+  else if (a < 0.0)
+    max_dist = -1.0;
+}
+
+BeamInterval ringInterval(double elevation, const double* transform, const ProjectionConfig& config,
+                          double range_max)
+{
+  // Height of the point at distance d along the beam at azimuth a is
+  // tz + d * (cos(e) * (r0 * cos(a) + r1 * sin(a)) + r2 * sin(e)), so over all
+  // azimuths its slope lies within r2 * sin(e) -+ cos(e) * hypot(r0, r1).
+  const double r0 = transform[8], r1 = transform[9], r2 = transform[10], tz = transform[11];
+  const double margin = 1e-3; // heights of the points are computed in float
+  const double min_height = config.slab_min_height - margin, max_height = config.slab_max_height + margin;
+  const double spread = cos(elevation) * hypot(r0, r1);
+  const double slope_min = r2 * sin(elevation) - spread, slope_max = r2 * sin(elevation) + spread;
+
+  // As in limitRowsToSlab(), points in range are at most max_dist away.
+  // Points closer than range_min minus the sensor's horizontal offset are
+  // too close in the output frame as well.
+  const double offset = hypot(transform[3], transform[7]);
+  const double dz = std::max(fabs(min_height - tz), fabs(max_height - tz));
+  const double horizontal = range_max + offset;
+  double min_dist = std::max(0.0, config.range_min - offset);
+  double max_dist = sqrt(horizontal * horizontal + dz * dz);
+
+  // the highest point at d must not be below the slab, the lowest not above it
+  keepNonNegative(tz - min_height, slope_max, min_dist, max_dist);
+  keepNonNegative(max_height - tz, -slope_min, min_dist, max_dist);
+
+  BeamInterval interval;
+  interval.min_dist = min_dist;
+  interval.max_dist = max_dist;
+  return interval;
+}
+
+void limitRowsToRings(PixelRegion& region, const std::vector<double>& elevations, const double* transform,
+                      const ProjectionConfig& config, double range_max)
+{
+  if (region.empty())
+    return;
+
+  uint32_t first = region.row_end, last = region.row_begin;
+  for (uint32_t row = region.row_begin; row < region.row_end; ++row)
+  {
+    if (!ringInterval(elevations[row], transform, config, range_max).empty())
+    {
+      first = std::min(first, row);
+      last = row;
+    }
+  }
+  limitRows(region, first, last);
+}
+
+void setPixelRay(PixelBin& bin, const ProjectionConfig& config, const double* transform,
+                 double dir_x, double dir_y, double dir_z)
+{
+  const double ray_x = transform[0] * dir_x + transform[1] * dir_y + transform[2] * dir_z;
+  const double ray_y = transform[4] * dir_x + transform[5] * dir_y + transform[6] * dir_z;
+  const double ray_z = transform[8] * dir_x + transform[9] * dir_y + transform[10] * dir_z;
+
+  bin.dir_x = dir_x;
+  bin.dir_y = dir_y;
+  bin.dir_z = dir_z;
+  bin.range_scale = sqrt(ray_x*ray_x + ray_y*ray_y);
+  bin.height_scale = ray_z;
+
+  int32_t index = config.exactBinIndex(ray_x, ray_y);
+  bin.index = index == ProjectionConfig::OUTSIDE ? (int32_t)PixelBin::OUTSIDE : index;
+}
+
+void learnPixel(PixelBin& bin, const ProjectionConfig& config, const double* transform, float px, float py, float pz)
+{
+  double norm = sqrt(px*px + py*py + pz*pz);
+  if (!(norm > 0.0))
+    return; // nan or degenerate point, try again with the next cloud
+
+  setPixelRay(bin, config, transform, px / norm, py / norm, pz / norm);
+}
+
+void ScanProjector::projectChunk(size_t chunk)
+{
+  ScopedAllocationTracking tracking;
+  const Job& job = job_;
+  size_t begin = job.num_points * chunk / job.num_chunks;
+  size_t end = job.num_points * (chunk + 1) / job.num_chunks;
+  float* const* ranges = chunk == 0 ? job.ranges : &partials_[chunk].scan_ranges[0];
+  filterAndBin(*job.view, begin, end, *job.params, job.kernel, *job.config, partials_[chunk], ranges,
+               partials_[chunk].counts);
+}
+
+/**
+ * Runs points [begin, end) of the view through the filter kernel in batches
+ * and bins the survivors into ranges.
+ */
+void ScanProjector::filterAndBin(const CloudView& view, size_t begin, size_t end, const FilterParams& params,
+                                 FilterKernel kernel, const ProjectionConfig& config, Partial& scratch,
+                                 float* const* ranges, PointCounts& counts)
+{
+#ifdef CLOUD_TO_SCAN_DEBUG_POINTS
+  // The kernels do not say why they drop a point. projectPoint() bins
+  // exactly like them and logs every rejection, only nan points of dense
+  // clouds count as nan instead of height or range.
+  double transform[12];
+  std::copy(params.transform, params.transform + 12, transform);
+  for (; begin < end; ++begin)
+  {
+    const uint8_t* data = view.data + (begin / view.width) * view.row_step + (begin % view.width) * view.point_step;
+    projectPoint(config, transform, readFloat(data), readFloat(data + 4), readFloat(data + 8), ranges, counts);
+  }
+#else
+  while (begin < end)
+  {
+    // batches never cross a row, rows may be padded
+    size_t row = begin / view.width, col = begin % view.width;
+    size_t batch = std::min(std::min(end - begin, view.width - col), (size_t)BATCH_SIZE);
+    const uint8_t* data = view.data + row * view.row_step + col * view.point_step;
+
+    size_t survivors = kernel(data, view.point_step, batch, params, &scratch.xs[0], &scratch.ys[0], &scratch.zs[0],
+                               &scratch.range_sq[0], counts);
+    for (size_t i = 0; i < survivors; ++i)
+      binPoint(config, scratch.xs[i], scratch.ys[i], scratch.zs[i], scratch.range_sq[i], ranges, counts);
+    begin += batch;
+  }
+#endif
+}
+
+} // namespace pointcloud_to_laserscan
@@ -0,0 +1,576 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef POINTCLOUD_TO_LASERSCAN_SCAN_PROJECTION_H
+#define POINTCLOUD_TO_LASERSCAN_SCAN_PROJECTION_H
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include "scan_kernels.h"
+#include "worker_pool.h"
+
+// Logging every rejected point is expensive even when debug output is
+// disabled at runtime. Build with CLOUD_TO_SCAN_DEBUG_POINTS to get it back,
+// on stderr since the projection does not depend on ROS.
+#ifdef CLOUD_TO_SCAN_DEBUG_POINTS
+#include <stdio.h>
+#define POINT_DEBUG(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define POINT_DEBUG(...)
+#endif
+
+namespace pointcloud_to_laserscan
+{
+
+/**
+ * Monotone stand-in for atan2(y, x) on (-pi, pi], mapping it to (-2, 2]
+ * without transcendental calls. NaN for x = y = 0.
+ */
+inline double pseudoAngle(double x, double y)
+{
+  return copysign(1.0 - x / (fabs(x) + fabs(y)), y);
+}
+
+/** Heights of the points binned into one scan. */
+struct HeightBand
+{
+  HeightBand(double min_height, double max_height): min_height(min_height), max_height(max_height) {}
+
+  bool contains(float z) const { return z >= min_height && z <= max_height; }
+
+  double min_height, max_height;
+};
+
+/**
+ * Scan geometry and point filter limits, all in the output frame. Bins are
+ * computed from the float angle values a sensor_msgs/LaserScan stores, so
+ * they match what consumers of the scan compute.
+ */
+struct ProjectionConfig
+{
+  ProjectionConfig();
+
+  /** Recomputes the derived values, call after changing any of the settings. */
+  void update();
+
+  enum { OUTSIDE = -1, AMBIGUOUS = -2 };
+
+  /**
+   * Returns the scan bin of direction (x, y), OUTSIDE if it misses the scan,
+   * or AMBIGUOUS if it is too close to a bin edge or angle_max to decide
+   * without computing the angle the way the scan defines it.
+   */
+  inline int32_t binIndex(float x, float y) const
+  {
+    const double p = pseudoAngle(x, y);
+    if (p != p)
+      return AMBIGUOUS;
+    if (p >= max_edge - EDGE_GUARD)
+    {
+      if (p > max_edge + EDGE_GUARD)
+        return OUTSIDE;
+      return AMBIGUOUS;
+    }
+
+    // count the edges at or below p, starting from the edges below its grid cell
+    size_t cell = std::min((size_t)((p + 2.0) * edge_cell_scale), edge_cells.size() - 1);
+    size_t edges = edge_cells[cell];
+    while (bin_edges[edges] <= p)
+      ++edges;
+
+    if (bin_edges[edges] - p < EDGE_GUARD || (edges > 0 && p - bin_edges[edges - 1] < EDGE_GUARD))
+      return AMBIGUOUS;
+    if (edges == 0 || edges > ranges_size)
+      return OUTSIDE;
+    return edges - 1;
+  }
+
+  /** Scan bin of direction (x, y) or OUTSIDE, computed through atan2. */
+  int32_t exactBinIndex(float x, float y) const;
+
+  /** Number of scans, i.e. of ranges buffers, filled from each cloud. */
+  size_t numScans() const { return bands.empty() ? 1 : bands.size(); }
+
+  double min_height, max_height, angle_min, angle_max, angle_increment, range_min;
+  int num_threads; // for binning a single cloud
+
+  // Height bands binned into scans of their own in the same pass. Empty for
+  // a single scan between min_height and max_height.
+  std::vector<HeightBand> bands;
+
+  double range_min_sq;
+  uint32_t ranges_size;
+  double slab_min_height, slab_max_height; // heights covered by any scan
+
+  // Pseudo-angles of the ranges_size + 1 bin edges and of angle_max, -inf or
+  // inf for angles outside (-pi, pi]. bin_edges ends with an inf sentinel.
+  std::vector<double> bin_edges;
+  double max_edge;
+  // number of edges below each cell of a uniform grid over the pseudo-angles
+  std::vector<uint32_t> edge_cells;
+  double edge_cell_scale;
+
+private:
+  // Far above the rounding errors of atan2 and the pseudo-angles. Directions
+  // this close to a bin edge are binned through atan2.
+  static const double EDGE_GUARD;
+
+  void updateBinEdges();
+};
+
+/** Whether height z falls into a band of config, always true without bands. */
+inline bool inAnyBand(const ProjectionConfig& config, float z)
+{
+  const std::vector<HeightBand>& bands = config.bands;
+  bool in_band = bands.empty();
+  for (size_t i = 0; i < bands.size() && !in_band; ++i)
+    in_band = bands[i].contains(z);
+  return in_band;
+}
+
+/**
+ * Keeps the closest return per bin: lowers bin index of every scan whose
+ * band contains height z to range. ranges holds config.numScans() buffers of
+ * config.ranges_size entries.
+ */
+inline void keepClosest(const ProjectionConfig& config, int32_t index, float z, float range, float* const* ranges)
+{
+  const std::vector<HeightBand>& bands = config.bands;
+  for (size_t i = 0; i < config.numScans(); ++i)
+  {
+    if ((bands.empty() || bands[i].contains(z)) && ranges[i][index] > range)
+      ranges[i][index] = range;
+  }
+}
+
+/**
+ * Bins the point at output x/y/z with the given squared range into the
+ * ranges of every scan whose band contains it, see keepClosest().
+ */
+inline void binPoint(const ProjectionConfig& config, float x, float y, float z, double range_sq, float* const* ranges,
+                     PointCounts& counts)
+{
+  if (!inAnyBand(config, z))
+  {
+    ++counts.height; // between two bands
+    return;
+  }
+
+  int32_t index = config.binIndex(x, y);
+  if (index == ProjectionConfig::AMBIGUOUS)
+    index = config.exactBinIndex(x, y);
+  if (index == ProjectionConfig::OUTSIDE)
+  {
+    ++counts.angle;
+    return;
+  }
+
+  ++counts.accepted;
+  keepClosest(config, index, z, sqrt(range_sq), ranges);
+}
+
+/**
+ * Transforms a point with the row-major 3x4 transform into the output frame
+ * and bins it if it passes the height and range filters. Computes in float,
+ * step for step like the filter kernels, so a point lands in the same bin
+ * with the same range whichever path it takes.
+ */
+inline void projectPoint(const ProjectionConfig& config, const double* transform, float px, float py, float pz,
+                         float* const* ranges, PointCounts& counts)
+{
+  // Most points fail the height test, so only z is computed up front. It is
+  // a single dot product with the slab normal in the cloud frame.
+  const float z = (float)transform[8] * px + (float)transform[9] * py + (float)transform[10] * pz + (float)transform[11];
+  if (z != z) // a nan in any coordinate ends up in z
+  {
+    POINT_DEBUG("rejected for nan in point(%f, %f, %f)\n", px, py, pz);
+    ++counts.nan;
+    return;
+  }
+  if (!(z >= (float)config.slab_min_height && z <= (float)config.slab_max_height))
+  {
+    POINT_DEBUG("rejected for height %f not in range (%f, %f)\n", z, config.slab_min_height, config.slab_max_height);
+    ++counts.height;
+    return;
+  }
+
+  const float x = (float)transform[0] * px + (float)transform[1] * py + (float)transform[2] * pz + (float)transform[3];
+  const float y = (float)transform[4] * px + (float)transform[5] * py + (float)transform[6] * pz + (float)transform[7];
+  const float range_sq = x * x + y * y;
+  if (!(range_sq >= (float)config.range_min_sq))
+  {
+    if (range_sq != range_sq)
+    {
+      POINT_DEBUG("rejected for nan in point(%f, %f, %f)\n", px, py, pz);
+      ++counts.nan;
+      return;
+    }
+    POINT_DEBUG("rejected for range %f below minimum value %f. Point: (%f, %f, %f)\n", range_sq, config.range_min_sq, x, y, z);
+    ++counts.range;
+    return;
+  }
+
+  binPoint(config, x, y, z, range_sq, ranges, counts);
+}
+
+/** Projects the points in [begin, end), anything with x, y and z members. */
+template <class Iterator>
+void projectPoints(Iterator begin, Iterator end, const ProjectionConfig& config, const double* transform,
+                   float* const* ranges, PointCounts& counts)
+{
+  for (; begin != end; ++begin)
+    projectPoint(config, transform, begin->x, begin->y, begin->z, ranges, counts);
+}
+
+/**
+ * Folds the ranges of another thread or sensor into ranges, keeping the
+ * closest return of every bin. Both hold config.numScans() buffers of
+ * config.ranges_size entries.
+ */
+void mergeRanges(float* const* ranges, const float* const* other, const ProjectionConfig& config);
+
+/** Points stored as three consecutive floats x, y, z, in rows of width points. */
+struct CloudView
+{
+  const uint8_t* data; // x of the first point
+  size_t point_step, row_step;
+  uint32_t width, height;
+  bool dense; // no nan points
+};
+
+/**
+ * Pixels [row_begin, row_end) x [col_begin, col_end) of an organized cloud or
+ * depth image, of which every row_stride-th row and col_stride-th column is
+ * processed.
+ */
+struct PixelRegion
+{
+  PixelRegion(uint32_t width, uint32_t height): row_begin(0), row_end(height), col_begin(0), col_end(width),
+                                                row_stride(1), col_stride(1) {}
+
+  bool empty() const { return row_begin >= row_end || col_begin >= col_end; }
+
+  uint32_t row_begin, row_end, col_begin, col_end;
+  uint32_t row_stride, col_stride;
+};
+
+/** Number of pixels processed for region. */
+size_t regionSize(const PixelRegion& region);
+
+/** The points of view selected by region, which has to lie within the view. */
+CloudView regionView(const CloudView& view, const PixelRegion& region);
+
+/**
+ * The pass-th of passes interleaved subsets of region, which together cover
+ * it: every passes-th of its columns, starting at offsets in bit-reversed
+ * order so each pass halves the gaps left by the previous ones. passes has
+ * to be a power of two.
+ */
+PixelRegion interleavedRegion(const PixelRegion& region, size_t pass, size_t passes);
+
+/**
+ * Pinhole camera: pixel (u, v) at depth d is the point
+ * d * ((u - cx) / fx, (v - cy) / fy, 1) in the optical frame.
+ */
+struct CameraIntrinsics
+{
+  double fx, fy, cx, cy;
+};
+
+/**
+ * Shrinks the rows of region to those with a pixel whose ray can reach the
+ * slab between config's heights within range_max. transform takes the
+ * optical frame into the output frame. Conservative, rows cut off can not
+ * contribute to the scan.
+ */
+void limitRowsToSlab(PixelRegion& region, const CameraIntrinsics& camera, const double* transform,
+                     const ProjectionConfig& config, double range_max);
+
+/** Distances [min_dist, max_dist] along a lidar beam from the sensor, empty if min_dist > max_dist. */
+struct BeamInterval
+{
+  bool empty() const { return !(min_dist <= max_dist); }
+
+  float min_dist, max_dist;
+};
+
+/**
+ * Distances at which the points of a lidar ring can lie inside the slab
+ * between config's heights within range_max, over all azimuths. The ring's
+ * beams leave the origin at elevation radians above the x/y plane of the
+ * cloud frame, transform takes the cloud frame into the output frame.
+ * Conservative, points outside it can not contribute to the scan.
+ */
+BeamInterval ringInterval(double elevation, const double* transform, const ProjectionConfig& config,
+                          double range_max);
+
+/**
+ * Shrinks the rows of region to those between the first and the last ring
+ * that can reach the slab, see ringInterval(). Row i of the cloud is the ring
+ * at elevations[i], which must cover the rows of region.
+ */
+void limitRowsToRings(PixelRegion& region, const std::vector<double>& elevations, const double* transform,
+                      const ProjectionConfig& config, double range_max);
+
+inline float readFloat(const uint8_t* ptr)
+{
+  float value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+/**
+ * Whether the point at ptr can reach the slab: its ring is unknown, or the
+ * point lies within the ring's interval, see ringInterval(). The ring is an
+ * unsigned integer of ring_size bytes, 1 or 2, at ring_offset. Only reads
+ * the ring and, if the ring can contribute at all, the point's distance from
+ * the sensor.
+ */
+inline bool ringMayContribute(const std::vector<BeamInterval>& intervals, const uint8_t* ptr, int ring_offset,
+                              size_t ring_size, int x_offset, int y_offset, int z_offset)
+{
+  size_t ring;
+  if (ring_size == 1)
+    ring = ptr[ring_offset];
+  else
+  {
+    uint16_t value;
+    memcpy(&value, ptr + ring_offset, sizeof(value));
+    ring = value;
+  }
+  if (ring >= intervals.size())
+    return true;
+
+  const BeamInterval& interval = intervals[ring];
+  if (interval.empty())
+    return false;
+  const float x = readFloat(ptr + x_offset), y = readFloat(ptr + y_offset), z = readFloat(ptr + z_offset);
+  const float dist_sq = x * x + y * y + z * z;
+  // nan points pass on and are counted as such
+  return !(dist_sq < interval.min_dist * interval.min_dist || dist_sq > interval.max_dist * interval.max_dist);
+}
+
+/**
+ * Lookup table entry for one pixel of an organized cloud or depth image. The
+ * virtual laser sits at the camera's x/y, so the scan bin of a pixel only
+ * depends on the direction of its ray. Range and height of a point are its
+ * distance along the ray times a constant per-pixel scale. This trades
+ * exactness for speed: the ray is binned once, so points of a pixel near a
+ * bin edge can land one bin off from where projectPoint() would put them.
+ */
+struct PixelBin
+{
+  enum { UNKNOWN = -2, OUTSIDE = -1 };
+
+  int32_t index;       // scan bin, OUTSIDE if the ray misses the scan's angular range, UNKNOWN until learned
+  float dir_x, dir_y, dir_z; // unit ray direction in the cloud frame
+  float range_scale;   // horizontal range per unit distance along the ray
+  float height_scale;  // height per unit distance along the ray
+};
+
+/**
+ * Sets up the bin of a pixel whose points lie at dist * dir in the cloud
+ * frame. dir does not have to be a unit vector, dist is measured in units of
+ * its length. Only the rotation of transform, which takes the cloud frame
+ * into the output frame, is used.
+ */
+void setPixelRay(PixelBin& bin, const ProjectionConfig& config, const double* transform,
+                 double dir_x, double dir_y, double dir_z);
+
+/**
+ * Sets up the bin of a pixel from the point px/py/pz seen at it. Leaves the
+ * bin unknown for nan or degenerate points, to try again with the next cloud.
+ */
+void learnPixel(PixelBin& bin, const ProjectionConfig& config, const double* transform, float px, float py, float pz);
+
+/**
+ * Bins the point at distance dist along the ray of a known pixel.
+ * height_offset is the height of the cloud frame's origin in the output
+ * frame.
+ */
+inline void binPixel(const ProjectionConfig& config, const PixelBin& bin, float height_offset, float dist,
+                     float* const* ranges, PointCounts& counts)
+{
+  // NaN compares false against everything, so invalid points drop out below
+  if (dist != dist)
+  {
+    ++counts.nan;
+    return;
+  }
+  if (bin.index == PixelBin::OUTSIDE)
+  {
+    ++counts.angle;
+    return;
+  }
+
+  const float z = dist * bin.height_scale + height_offset;
+  if (!(z <= config.slab_max_height && z >= config.slab_min_height))
+  {
+    ++counts.height;
+    return;
+  }
+
+  const float range = dist * bin.range_scale;
+  if (!(range >= config.range_min))
+  {
+    ++counts.range;
+    return;
+  }
+
+  if (!inAnyBand(config, z))
+  {
+    ++counts.height; // between two bands
+    return;
+  }
+  ++counts.accepted;
+  keepClosest(config, bin.index, z, range, ranges);
+}
+
+/**
+ * Bins the point px/py/pz of a pixel of an organized cloud, learning the
+ * pixel's ray from it if the bin is still unknown.
+ */
+inline void addPixel(const ProjectionConfig& config, PixelBin& bin, const double* transform, float height_offset,
+                     float px, float py, float pz, float* const* ranges, PointCounts& counts)
+{
+  if (bin.index == PixelBin::UNKNOWN)
+  {
+    learnPixel(bin, config, transform, px, py, pz);
+    projectPoint(config, transform, px, py, pz, ranges, counts);
+    return;
+  }
+
+  binPixel(config, bin, height_offset, px * bin.dir_x + py * bin.dir_y + pz * bin.dir_z, ranges, counts);
+}
+
+/** Depth in meters, NaN for invalid pixels. 16UC1 images are in millimeters with 0 for no return. */
+inline float depthInMeters(uint16_t depth)
+{
+  return depth == 0 ? std::numeric_limits<float>::quiet_NaN() : depth * 0.001f;
+}
+
+inline float depthInMeters(float depth)
+{
+  return depth;
+}
+
+/**
+ * Bins the pixels of region of a depth image with rows of step bytes, each
+ * pixel a T, through the table bins of width entries per row.
+ */
+template <class T>
+void binDepthImage(const ProjectionConfig& config, const uint8_t* data, size_t step, uint32_t width,
+                   const PixelRegion& region, const PixelBin* bins, float height_offset, float* const* ranges,
+                   PointCounts& counts)
+{
+  for (uint32_t row = region.row_begin; row < region.row_end; row += region.row_stride)
+  {
+    const uint8_t* ptr = data + row * step + region.col_begin * sizeof(T);
+    const PixelBin* row_bins = bins + row * width;
+    for (uint32_t col = region.col_begin; col < region.col_end; col += region.col_stride, ptr += region.col_stride * sizeof(T))
+    {
+      T depth;
+      memcpy(&depth, ptr, sizeof(depth));
+      binPixel(config, row_bins[col], height_offset, depthInMeters(depth), ranges, counts);
+    }
+  }
+}
+
+/**
+ * Projects clouds through a filter kernel, splitting large clouds across a
+ * pool of threads. Keeps its scratch buffers between clouds, so projecting
+ * does not allocate in steady state. Not thread safe.
+ */
+class ScanProjector : boost::noncopyable
+{
+public:
+  ScanProjector();
+
+  void setKernel(FilterKernel kernel) { kernel_ = kernel; }
+
+  /**
+   * Splits large clouds across pool instead of a pool of the projector's
+   * own, so projectors working at the same time share their threads. The
+   * caller keeps ownership, NULL goes back to the own pool.
+   */
+  void setPool(WorkerPool* pool) { shared_pool_ = pool; }
+
+  /**
+   * Filters and bins all points of the view into ranges, which holds
+   * config.numScans() buffers of config.ranges_size entries. The points go
+   * through the version of the kernel specialized for the view's point step
+   * and density. Large clouds are split into one chunk per
+   * thread. Each chunk is binned into private ranges, which are then
+   * min-reduced, so the result does not depend on the number of threads.
+   */
+  void project(const CloudView& view, const double* transform, const ProjectionConfig& config,
+               float* const* ranges, PointCounts& counts);
+
+private:
+  enum { BATCH_SIZE = 1024, MIN_POINTS_PER_THREAD = 20000 };
+
+  /** Scratch space of one binning thread. */
+  struct Partial
+  {
+    std::vector<float> xs, ys, zs, range_sq; // filter kernel output
+    std::vector<float> ranges;               // private ranges of all scans, unused by the first thread
+    std::vector<float*> scan_ranges;         // start of each scan's private ranges
+    PointCounts counts;
+  };
+
+  struct Job
+  {
+    const CloudView* view;
+    const FilterParams* params;
+    FilterKernel kernel;
+    const ProjectionConfig* config;
+    float* const* ranges;
+    size_t num_points, num_chunks;
+  };
+
+  void projectChunk(size_t chunk);
+  void filterAndBin(const CloudView& view, size_t begin, size_t end, const FilterParams& params, FilterKernel kernel,
+                    const ProjectionConfig& config, Partial& scratch, float* const* ranges, PointCounts& counts);
+
+  FilterKernel kernel_;
+  WorkerPool* shared_pool_;
+  boost::scoped_ptr<WorkerPool> pool_; // if there is no shared one
+  std::vector<Partial> partials_;
+  Job job_;
+  WorkerPool::LoopBody project_chunk_;
+};
+
+} // namespace pointcloud_to_laserscan
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "worker_pool.h"
+
+namespace pointcloud_to_laserscan
+{
+
+WorkerPool::WorkerPool(size_t num_threads): loops_(NULL), shutdown_(false)
+{
+  for (size_t i = 0; i < num_threads; ++i)
+    threads_.push_back(new boost::thread(boost::bind(&WorkerPool::workerLoop, this)));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  cond_.notify_all();
+  for (size_t i = 0; i < threads_.size(); ++i)
+  {
+    threads_[i]->join();
+    delete threads_[i];
+  }
+}
+
+void WorkerPool::post(const Task& task)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    tasks_.push_back(task);
+  }
+  // threads waiting in parallelFor() share the condition but leave tasks alone
+  cond_.notify_all();
+}
+
+void WorkerPool::parallelFor(size_t count, const LoopBody& body)
+{
+  if (count == 0)
+    return;
+
+  Loop loop;
+  loop.body = &body;
+  loop.next = 0;
+  loop.count = count;
+  loop.remaining = count;
+
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  loop.next_loop = loops_;
+  loops_ = &loop;
+  cond_.notify_all();
+
+  while (loop.remaining > 0)
+  {
+    if (!runOne(lock, false))
+      cond_.wait(lock);
+  }
+
+  // unlink, other loops may have been pushed in front of ours meanwhile
+  Loop** link = &loops_;
+  while (*link != &loop)
+    link = &(*link)->next_loop;
+  *link = loop.next_loop;
+}
+
+bool WorkerPool::runOne(boost::unique_lock<boost::mutex>& lock, bool run_tasks)
+{
+  for (Loop* loop = loops_; loop != NULL; loop = loop->next_loop)
+  {
+    if (loop->next < loop->count)
+    {
+      size_t i = loop->next++;
+      lock.unlock();
+      (*loop->body)(i);
+      lock.lock();
+      if (--loop->remaining == 0)
+        cond_.notify_all();
+      return true;
+    }
+  }
+
+  if (run_tasks && !tasks_.empty())
+  {
+    Task task;
+    task.swap(tasks_.front());
+    tasks_.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+    return true;
+  }
+
+  return false;
+}
+
+void WorkerPool::workerLoop()
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (!shutdown_)
+  {
+    if (!runOne(lock, true))
+      cond_.wait(lock);
+  }
+}
+
+} // namespace pointcloud_to_laserscan
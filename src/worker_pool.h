@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef POINTCLOUD_TO_LASERSCAN_WORKER_POOL_H
+#define POINTCLOUD_TO_LASERSCAN_WORKER_POOL_H
+
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+namespace pointcloud_to_laserscan
+{
+
+/**
+ * A fixed set of worker threads that run queued tasks and parallel loops.
+ * Threads waiting in parallelFor() help with the iterations of pending
+ * loops, so loops may be started from inside tasks without deadlocking the
+ * pool. They do not pick up queued tasks, which could keep them busy long
+ * after their own loop is done.
+ */
+class WorkerPool : boost::noncopyable
+{
+public:
+  typedef boost::function<void()> Task;
+  typedef boost::function<void(size_t)> LoopBody;
+
+  explicit WorkerPool(size_t num_threads);
+  ~WorkerPool();
+
+  size_t size() const { return threads_.size(); }
+
+  /** Queues a task to be run by one of the workers. */
+  void post(const Task& task);
+
+  /**
+   * Calls body(i) for every i in [0, count) and returns once all calls are
+   * done. The calling thread runs iterations as well.
+   */
+  void parallelFor(size_t count, const LoopBody& body);
+
+private:
+  struct Loop
+  {
+    const LoopBody* body;
+    size_t next, count, remaining;
+    Loop* next_loop;
+  };
+
+  // Claims and runs one loop iteration or, if run_tasks, queued task.
+  // Expects lock to be held.
+  bool runOne(boost::unique_lock<boost::mutex>& lock, bool run_tasks);
+  void workerLoop();
+
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  std::deque<Task> tasks_;
+  Loop* loops_;
+  bool shutdown_;
+  std::vector<boost::thread*> threads_;
+};
+
+} // namespace pointcloud_to_laserscan
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks that the pseudo-angle bin table agrees with atan2 wherever it does
+ * not defer to it, on random directions and on directions next to the bin
+ * edges, angle_min and angle_max.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <limits>
+#include <gtest/gtest.h>
+#include "scan_projection.h"
+
+using namespace pointcloud_to_laserscan;
+
+namespace
+{
+
+ProjectionConfig makeConfig(double angle_min, double angle_max, double angle_increment)
+{
+  ProjectionConfig config;
+  config.angle_min = angle_min;
+  config.angle_max = angle_max;
+  config.angle_increment = angle_increment;
+  config.update();
+  return config;
+}
+
+/** Checks direction (x, y) and returns whether binIndex() had to defer to atan2. */
+bool checkPoint(const ProjectionConfig& config, float x, float y)
+{
+  const int32_t index = config.binIndex(x, y);
+  if (index == ProjectionConfig::AMBIGUOUS)
+    return true;
+  EXPECT_EQ(config.exactBinIndex(x, y), index) << "x " << x << " y " << y;
+  return false;
+}
+
+bool checkDirection(const ProjectionConfig& config, double angle, double radius)
+{
+  return checkPoint(config, radius * cos(angle), radius * sin(angle));
+}
+
+/** Checks the float points a few ulps around the one closest to angle, those straddle its edge. */
+void checkAround(const ProjectionConfig& config, double angle, double radius)
+{
+  const float x0 = radius * cos(angle), y0 = radius * sin(angle);
+  const float up = std::numeric_limits<float>::infinity();
+  float x = x0;
+  for (int i = 0; i < 4; ++i, x = nextafterf(x, up))
+  {
+    float y = y0;
+    for (int j = 0; j < 4; ++j, y = nextafterf(y, up))
+      checkPoint(config, x, y);
+    y = y0;
+    for (int j = 0; j < 4; ++j, y = nextafterf(y, -up))
+      checkPoint(config, x, y);
+  }
+  x = x0;
+  for (int i = 0; i < 4; ++i, x = nextafterf(x, -up))
+  {
+    float y = y0;
+    for (int j = 0; j < 4; ++j, y = nextafterf(y, up))
+      checkPoint(config, x, y);
+    y = y0;
+    for (int j = 0; j < 4; ++j, y = nextafterf(y, -up))
+      checkPoint(config, x, y);
+  }
+}
+
+void checkConfig(const ProjectionConfig& config)
+{
+  srand48(42);
+  size_t ambiguous = 0;
+  const size_t random_points = 200000;
+  for (size_t i = 0; i < random_points; ++i)
+    ambiguous += checkDirection(config, (drand48() * 2.0 - 1.0) * M_PI, 0.01 + drand48() * 50.0);
+  // the guard band is tiny, random directions almost never land in it
+  EXPECT_LT(ambiguous, random_points / 1000);
+
+  // the bin edges and angle_max, as the scan stores them, and their neighbours
+  const double amin = (float)config.angle_min, inc = (float)config.angle_increment;
+  const double offsets[] = { 0.0, 1e-12, -1e-12, 1e-9, -1e-9, 1e-7, -1e-7, 1e-5, -1e-5 };
+  const double radii[] = { 0.3, 1.0, 7.0, 37.5 };
+  for (uint32_t i = 0; i <= config.ranges_size; ++i)
+  {
+    for (size_t j = 0; j < sizeof(offsets) / sizeof(offsets[0]); ++j)
+      checkDirection(config, amin + i * inc + offsets[j], 1.0);
+    for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); ++r)
+      checkAround(config, amin + i * inc, radii[r]);
+  }
+  for (size_t j = 0; j < sizeof(offsets) / sizeof(offsets[0]); ++j)
+    checkDirection(config, (float)config.angle_max + offsets[j], 3.0);
+  for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); ++r)
+    checkAround(config, (float)config.angle_max, radii[r]);
+}
+
+} // namespace
+
+TEST(BinIndex, HalfCircle)
+{
+  checkConfig(makeConfig(-M_PI / 2, M_PI / 2, M_PI / 180.0 / 2.0));
+}
+
+TEST(BinIndex, FullCircle)
+{
+  checkConfig(makeConfig(-M_PI, M_PI, M_PI / 360.0));
+}
+
+TEST(BinIndex, UnevenIncrement)
+{
+  checkConfig(makeConfig(-2.0, 1.3, 0.0123));
+}
+
+TEST(BinIndex, NarrowFineBins)
+{
+  checkConfig(makeConfig(-0.3, 0.25, 0.0001));
+}
+
+TEST(BinIndex, AcrossPi)
+{
+  checkConfig(makeConfig(-3.1, 3.14159, 0.05));
+}
+
+TEST(BinIndex, AxisDirections)
+{
+  const ProjectionConfig configs[] = { makeConfig(-M_PI / 2, M_PI / 2, M_PI / 360.0),
+                                       makeConfig(-M_PI, M_PI, M_PI / 360.0),
+                                       makeConfig(0.0, M_PI, 0.01) };
+  // signed zeros: y = -0 behind the sensor has to agree with atan2 as well
+  const float xs[] = { 1.0f, -1.0f, 0.0f, -0.0f, 1.0f, -1.0f, 0.0f, -0.0f };
+  const float ys[] = { 0.0f, 0.0f, 1.0f, 1.0f, -0.0f, -0.0f, -1.0f, -1.0f };
+  for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); ++c)
+  {
+    for (size_t i = 0; i < sizeof(xs) / sizeof(xs[0]); ++i)
+    {
+      const int32_t index = configs[c].binIndex(xs[i], ys[i]);
+      if (index != ProjectionConfig::AMBIGUOUS)
+      {
+        EXPECT_EQ(configs[c].exactBinIndex(xs[i], ys[i]), index) << "x " << xs[i] << " y " << ys[i];
+      }
+    }
+  }
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks that fusing the scans of several sensors, each projected on its own
+ * as in the nodelet's fusion mode, gives the same scan as projecting all
+ * their points at once.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "scan_projection.h"
+
+using namespace pointcloud_to_laserscan;
+
+namespace
+{
+
+const float NaN = std::numeric_limits<float>::quiet_NaN();
+
+/** Random points of point_step bytes around the sensor, some of them nan. */
+std::vector<uint8_t> makeCloud(size_t num_points, size_t point_step)
+{
+  std::vector<uint8_t> data(num_points * point_step);
+  for (size_t i = 0; i < num_points; ++i)
+  {
+    float p[3];
+    for (int j = 0; j < 3; ++j)
+      p[j] = (drand48() * 2.0 - 1.0) * (j == 2 ? 1.0 : 8.0);
+    if (i % 17 == 0)
+      p[i % 3] = NaN;
+    memcpy(&data[i * point_step], p, sizeof(p));
+  }
+  return data;
+}
+
+CloudView makeView(const uint8_t* data, size_t point_step, uint32_t width)
+{
+  CloudView view;
+  view.data = data;
+  view.point_step = point_step;
+  view.row_step = width * point_step;
+  view.width = width;
+  view.height = 1;
+  view.dense = false;
+  return view;
+}
+
+struct Ranges
+{
+  Ranges(const ProjectionConfig& config):
+    data(config.numScans() * config.ranges_size, std::numeric_limits<float>::infinity())
+  {
+    for (size_t i = 0; i < config.numScans(); ++i)
+      scans.push_back(&data[i * config.ranges_size]);
+  }
+
+  std::vector<float> data;
+  std::vector<float*> scans;
+};
+
+void checkFusion(const ProjectionConfig& config, const std::string& kernel_name, size_t num_sensors)
+{
+  srand48(7);
+  const size_t point_step = 32, points_per_sensor = 30000;
+  const std::vector<uint8_t> cloud = makeCloud(num_sensors * points_per_sensor, point_step);
+  const double transform[12] = { 0.8, -0.6, 0, 0.1,
+                                 0.6,  0.8, 0, -0.2,
+                                 0,    0,   1, 0.3 };
+  const FilterKernel kernel = selectFilterKernel(kernel_name);
+
+  // all points at once
+  Ranges single(config);
+  PointCounts single_counts;
+  ScanProjector projector;
+  projector.setKernel(kernel);
+  projector.project(makeView(&cloud[0], point_step, cloud.size() / point_step), transform, config, &single.scans[0],
+                    single_counts);
+
+  // each sensor on its own, merged
+  Ranges fused(config);
+  PointCounts fused_counts;
+  for (size_t i = 0; i < num_sensors; ++i)
+  {
+    Ranges sensor(config);
+    ScanProjector sensor_projector;
+    sensor_projector.setKernel(kernel);
+    sensor_projector.project(makeView(&cloud[i * points_per_sensor * point_step], point_step, points_per_sensor),
+                             transform, config, &sensor.scans[0], fused_counts);
+    mergeRanges(&fused.scans[0], &sensor.scans[0], config);
+  }
+
+  ASSERT_EQ(single.data.size(), fused.data.size());
+  for (size_t i = 0; i < single.data.size(); ++i)
+    EXPECT_EQ(single.data[i], fused.data[i]) << "bin " << i;
+  EXPECT_EQ(single_counts.accepted, fused_counts.accepted);
+  EXPECT_EQ(single_counts.nan, fused_counts.nan);
+  EXPECT_EQ(single_counts.height, fused_counts.height);
+  EXPECT_EQ(single_counts.range, fused_counts.range);
+  EXPECT_EQ(single_counts.angle, fused_counts.angle);
+}
+
+ProjectionConfig makeConfig(int num_threads, bool bands)
+{
+  ProjectionConfig config;
+  config.min_height = -0.2;
+  config.max_height = 0.5;
+  config.angle_min = -M_PI;
+  config.angle_max = M_PI;
+  config.angle_increment = M_PI / 360.0;
+  config.range_min = 0.3;
+  config.num_threads = num_threads;
+  if (bands)
+  {
+    config.bands.push_back(HeightBand(-0.2, 0.1));
+    config.bands.push_back(HeightBand(0.2, 0.5));
+  }
+  config.update();
+  return config;
+}
+
+} // namespace
+
+TEST(Fusion, MatchesSingleCloud)
+{
+  const char* kernels[] = { "scalar", "auto" };
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+  {
+    checkFusion(makeConfig(1, false), kernels[k], 2);
+    checkFusion(makeConfig(1, false), kernels[k], 3);
+  }
+}
+
+TEST(Fusion, MatchesSingleCloudWithBands)
+{
+  checkFusion(makeConfig(1, true), "auto", 3);
+}
+
+TEST(Fusion, MatchesThreadedSingleCloud)
+{
+  checkFusion(makeConfig(4, true), "auto", 2);
+}
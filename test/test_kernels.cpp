@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks that every filter kernel, generic and specialized, bins a cloud
+ * exactly like projectPoint(), which the clouds without packed x/y/z go
+ * through.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "scan_projection.h"
+
+using namespace pointcloud_to_laserscan;
+
+namespace
+{
+
+/** Random points of point_step bytes, with nan and boundary points mixed in. */
+std::vector<uint8_t> makeCloud(size_t num_points, size_t point_step, bool dense)
+{
+  std::vector<uint8_t> data(num_points * point_step + 16);
+  for (size_t i = 0; i < num_points; ++i)
+  {
+    float p[3];
+    for (int j = 0; j < 3; ++j)
+      p[j] = (drand48() * 2.0 - 1.0) * (j == 2 ? 1.0 : 8.0);
+    if (!dense && i % 13 == 0)
+      p[i % 3] = std::numeric_limits<float>::quiet_NaN();
+    memcpy(&data[i * point_step], p, sizeof(p));
+  }
+  return data;
+}
+
+struct Ranges
+{
+  Ranges(const ProjectionConfig& config):
+    data(config.numScans() * config.ranges_size, std::numeric_limits<float>::infinity())
+  {
+    for (size_t i = 0; i < config.numScans(); ++i)
+      scans.push_back(&data[i * config.ranges_size]);
+  }
+
+  std::vector<float> data;
+  std::vector<float*> scans;
+};
+
+void checkKernel(const std::string& kernel_name, size_t point_step, bool dense)
+{
+  SCOPED_TRACE(kernel_name);
+  SCOPED_TRACE(point_step);
+  srand48(11);
+  ProjectionConfig config;
+  config.min_height = -0.13;
+  config.max_height = 0.37;
+  config.angle_min = -M_PI;
+  config.angle_max = M_PI;
+  config.angle_increment = M_PI / 360.0;
+  config.range_min = 0.31;
+  config.bands.push_back(HeightBand(-0.13, 0.11));
+  config.bands.push_back(HeightBand(0.17, 0.37));
+  config.update();
+
+  // a rotation about a tilted axis, none of its entries exact in float
+  const double c = cos(0.7), s = sin(0.7), t = 0.1;
+  const double transform[12] = { c,  -s * cos(t), s * sin(t),  0.13,
+                                 s,   c * cos(t), -c * sin(t), -0.29,
+                                 0,   sin(t),     cos(t),      0.21 };
+  const size_t num_points = 20011;
+  const std::vector<uint8_t> cloud = makeCloud(num_points, point_step, dense);
+
+  Ranges expected(config);
+  PointCounts expected_counts;
+  for (size_t i = 0; i < num_points; ++i)
+  {
+    float p[3];
+    memcpy(p, &cloud[i * point_step], sizeof(p));
+    projectPoint(config, transform, p[0], p[1], p[2], &expected.scans[0], expected_counts);
+  }
+
+  CloudView view;
+  view.data = &cloud[0];
+  view.point_step = point_step;
+  view.row_step = num_points * point_step;
+  view.width = num_points;
+  view.height = 1;
+  view.dense = dense;
+  Ranges ranges(config);
+  PointCounts counts;
+  ScanProjector projector;
+  projector.setKernel(selectFilterKernel(kernel_name));
+  projector.project(view, transform, config, &ranges.scans[0], counts);
+
+  for (size_t i = 0; i < expected.data.size(); ++i)
+    EXPECT_EQ(expected.data[i], ranges.data[i]) << "bin " << i;
+  EXPECT_EQ(expected_counts.accepted, counts.accepted);
+  EXPECT_EQ(expected_counts.angle, counts.angle);
+  if (!dense)
+  {
+    // dense kernels count nan points as height or range rejections
+    EXPECT_EQ(expected_counts.nan, counts.nan);
+    EXPECT_EQ(expected_counts.height, counts.height);
+    EXPECT_EQ(expected_counts.range, counts.range);
+  }
+}
+
+} // namespace
+
+TEST(Kernels, MatchProjectPoint)
+{
+  const char* kernels[] = { "scalar", "sse", "avx2" };
+  const size_t steps[] = { 12, 16, 20, 32, 48 };
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+  {
+    for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); ++s)
+    {
+      checkKernel(kernels[k], steps[s], false);
+      checkKernel(kernels[k], steps[s], true);
+    }
+  }
+}
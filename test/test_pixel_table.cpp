@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2010, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks that binning a depth image through its pixel table agrees with
+ * projecting every pixel as a point, up to the rounding the table trades
+ * for speed.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+#include <vector>
+#include <gtest/gtest.h>
+#include "scan_projection.h"
+
+using namespace pointcloud_to_laserscan;
+
+namespace
+{
+
+const uint32_t WIDTH = 160, HEIGHT = 120;
+const double FX = 120.0, FY = 120.0, CX = 80.0, CY = 60.0;
+
+// optical frame into the output frame: x forward, y left, z up, 0.5 m above it
+const double TRANSFORM[12] = { 0, 0, 1, 0,
+                              -1, 0, 0, 0,
+                               0,-1, 0, 0.5 };
+
+struct Ranges
+{
+  Ranges(const ProjectionConfig& config):
+    data(config.numScans() * config.ranges_size, std::numeric_limits<float>::infinity())
+  {
+    for (size_t i = 0; i < config.numScans(); ++i)
+      scans.push_back(&data[i * config.ranges_size]);
+  }
+
+  std::vector<float> data;
+  std::vector<float*> scans;
+};
+
+void checkDepthImage(const ProjectionConfig& config)
+{
+  srand48(5);
+  std::vector<float> depths(WIDTH * HEIGHT);
+  for (size_t i = 0; i < depths.size(); ++i)
+    depths[i] = i % 11 == 0 ? std::numeric_limits<float>::quiet_NaN() : 0.3 + drand48() * 6.0;
+
+  std::vector<PixelBin> bins(WIDTH * HEIGHT);
+  for (uint32_t v = 0; v < HEIGHT; ++v)
+  {
+    for (uint32_t u = 0; u < WIDTH; ++u)
+      setPixelRay(bins[v * WIDTH + u], config, TRANSFORM, (u - CX) / FX, (v - CY) / FY, 1.0);
+  }
+  Ranges table(config);
+  PointCounts table_counts;
+  binDepthImage<float>(config, reinterpret_cast<const uint8_t*>(&depths[0]), WIDTH * sizeof(float), WIDTH,
+                       PixelRegion(WIDTH, HEIGHT), &bins[0], TRANSFORM[11], &table.scans[0], table_counts);
+
+  Ranges points(config);
+  PointCounts point_counts;
+  for (uint32_t v = 0; v < HEIGHT; ++v)
+  {
+    for (uint32_t u = 0; u < WIDTH; ++u)
+    {
+      const float d = depths[v * WIDTH + u];
+      projectPoint(config, TRANSFORM, d * (float)((u - CX) / FX), d * (float)((v - CY) / FY), d, &points.scans[0],
+                   point_counts);
+    }
+  }
+
+  EXPECT_EQ(point_counts.nan, table_counts.nan);
+  EXPECT_NEAR(point_counts.accepted, table_counts.accepted, 2);
+  EXPECT_GT(table_counts.accepted, 1000u);
+
+  // a pixel near a bin edge may land next to where its points would
+  size_t moved = 0;
+  for (size_t i = 0; i < points.data.size(); ++i)
+  {
+    if (isinf(points.data[i]) != isinf(table.data[i]))
+      ++moved;
+    else if (!isinf(points.data[i]) && fabs(points.data[i] - table.data[i]) > 1e-5 * points.data[i])
+      ++moved;
+  }
+  EXPECT_LE(moved, points.data.size() / 50);
+}
+
+ProjectionConfig makeConfig()
+{
+  ProjectionConfig config;
+  config.min_height = 0.2;
+  config.max_height = 0.8;
+  config.angle_min = -M_PI / 3;
+  config.angle_max = M_PI / 3;
+  config.angle_increment = M_PI / 360.0;
+  config.range_min = 0.4;
+  return config;
+}
+
+} // namespace
+
+TEST(PixelTable, DepthImageMatchesPoints)
+{
+  ProjectionConfig config = makeConfig();
+  config.update();
+  checkDepthImage(config);
+}
+
+TEST(PixelTable, DepthImageMatchesPointsWithBands)
+{
+  ProjectionConfig config = makeConfig();
+  config.bands.push_back(HeightBand(0.2, 0.4));
+  config.bands.push_back(HeightBand(0.5, 0.8));
+  config.update();
+  checkDepthImage(config);
+}
+
+TEST(PixelTable, DepthInMeters)
+{
+  EXPECT_TRUE(isnan(depthInMeters((uint16_t)0)));
+  EXPECT_FLOAT_EQ(1.234f, depthInMeters((uint16_t)1234));
+  EXPECT_EQ(2.5f, depthInMeters(2.5f));
+}
+
+TEST(PixelTable, UnknownPixelLearnsRay)
+{
+  ProjectionConfig config = makeConfig();
+  config.update();
+  PixelBin bin;
+  bin.index = PixelBin::UNKNOWN;
+  Ranges ranges(config);
+  PointCounts counts;
+
+  // a nan point leaves the pixel to the next cloud
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  addPixel(config, bin, TRANSFORM, TRANSFORM[11], nan, nan, nan, &ranges.scans[0], counts);
+  EXPECT_EQ(PixelBin::UNKNOWN, bin.index);
+  EXPECT_EQ(1u, counts.nan);
+
+  // straight ahead, 0.2 m below the camera
+  addPixel(config, bin, TRANSFORM, TRANSFORM[11], 0.0f, 0.2f, 2.0f, &ranges.scans[0], counts);
+  ASSERT_GE(bin.index, 0);
+  EXPECT_EQ(config.exactBinIndex(1.0f, 0.0f), bin.index);
+  EXPECT_FLOAT_EQ(2.0f, ranges.scans[0][bin.index]);
+
+  // further along the same ray, through the table
+  addPixel(config, bin, TRANSFORM, TRANSFORM[11], 0.0f, 0.1f, 1.0f, &ranges.scans[0], counts);
+  EXPECT_FLOAT_EQ(1.0f, ranges.scans[0][bin.index]);
+  EXPECT_EQ(2u, counts.accepted);
+}
+
+TEST(PixelTable, RingMayContribute)
+{
+  std::vector<BeamInterval> intervals(2);
+  intervals[0].min_dist = 1.0f;
+  intervals[0].max_dist = 5.0f;
+  intervals[1].min_dist = 1.0f;
+  intervals[1].max_dist = 0.0f; // can not reach the slab
+
+  uint8_t point[16] = {};
+  const float p[3] = { 3.0f, 0.0f, 0.0f };
+  memcpy(point, p, sizeof(p));
+
+  point[12] = 0;
+  EXPECT_TRUE(ringMayContribute(intervals, point, 12, 1, 0, 4, 8));
+  point[12] = 1;
+  EXPECT_FALSE(ringMayContribute(intervals, point, 12, 1, 0, 4, 8));
+  point[12] = 7; // unknown ring
+  EXPECT_TRUE(ringMayContribute(intervals, point, 12, 1, 0, 4, 8));
+
+  const uint16_t ring = 0;
+  memcpy(point + 12, &ring, sizeof(ring));
+  const float far[3] = { 6.0f, 0.0f, 0.0f };
+  memcpy(point, far, sizeof(far));
+  EXPECT_FALSE(ringMayContribute(intervals, point, 12, 2, 0, 4, 8));
+}